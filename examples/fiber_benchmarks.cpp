@@ -8,16 +8,61 @@
 #include <mutex>
 #include <condition_variable>
 #include <cstring>
+#include <cstdlib>
+#include <new>
 #include <vector>
-#include <cstring>
+#include <string>
+#include <algorithm>
 #include <cerrno>
 #include <exception>
+#include <fstream>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 namespace fibers = boost::fibers;
 namespace this_fiber = boost::this_fiber;
 
+// Heap allocations made by the calling thread, for allocations per operation
+thread_local uint64_t allocation_count = 0;
+
+void* operator new(std::size_t size)
+{
+    allocation_count++;
+    void* memory = std::malloc(size);
+    if (!memory) throw std::bad_alloc{};
+    return memory;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+// Not inlined, since GCC would then see free() called on memory from operator
+// new at each call site and warn about it
+__attribute__((noinline)) void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    operator delete(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
 class dummy_lock
 {
 public:
@@ -53,7 +98,7 @@ void bench_many_fibers()
     measure.finish(num_fibers);
 }
 
-void bench_echo_one_byte()
+void echo_one_byte(bool streaming)
 {
     fiberio::use_on_this_thread();
 
@@ -64,9 +109,10 @@ void bench_echo_one_byte()
     const uint64_t num_iterations{ 100 };
     const int num_clients{ 1000 };
 
-    auto server_future = fibers::async([&server]() {
+    auto server_future = fibers::async([&server, streaming]() {
         for (int c = 0; c < num_clients; c++) {
             auto server_client = server.accept();
+            if (streaming) server_client.set_streaming(true);
             fibers::async([](fiberio::socket client) {
                 char buf[1];
                 for (uint64_t i = 0; i < num_iterations; i++) {
@@ -81,6 +127,7 @@ void bench_echo_one_byte()
     std::vector<fiberio::socket> clients(num_clients);
     for (auto& client : clients) {
         client.connect(server.get_host(), server.get_port());
+        if (streaming) client.set_streaming(true);
     }
 
     this_fiber::sleep_for(std::chrono::microseconds{10});
@@ -107,6 +154,670 @@ void bench_echo_one_byte()
     server.close();
 }
 
+void bench_echo_one_byte()
+{
+    echo_one_byte(false);
+}
+
+void bench_echo_one_byte_streaming()
+{
+    echo_one_byte(true);
+}
+
+void bench_echo_one_byte_acceptor()
+{
+    // Like bench_echo_one_byte, but one thread accepts the connections and
+    // hands them to num_workers threads that run the server side
+    const uint64_t num_iterations{ 100 };
+    const int num_clients{ 1000 };
+    const int num_workers{ 2 };
+
+    fiberio::use_on_this_thread();
+    fiberio::acceptor acceptor;
+
+    std::vector<std::promise<void>> joined(num_workers);
+    std::vector<std::thread> workers;
+    for (auto& promise : joined) {
+        workers.emplace_back([&acceptor, &promise]() {
+            fiberio::use_on_this_thread();
+            acceptor.join();
+            promise.set_value();
+            std::vector<fibers::future<void>> futures;
+            while (true) {
+                fiberio::socket server_client;
+                try {
+                    server_client = acceptor.receive();
+                } catch (std::runtime_error& e) {
+                    break;
+                }
+                futures.push_back(fibers::async([](fiberio::socket client) {
+                    char buf[1];
+                    for (uint64_t i = 0; i < num_iterations; i++) {
+                        client.read_exactly(buf, sizeof(buf));
+                        client.write(buf, sizeof(buf));
+                    }
+                    client.close();
+                }, std::move(server_client)));
+            }
+            for (auto& future : futures) {
+                future.get();
+            }
+        });
+    }
+    for (auto& promise : joined) {
+        promise.get_future().get();
+    }
+
+    fibers::promise<void> done;
+    std::promise<uint16_t> port;
+    std::thread acceptor_thread{ [&acceptor, &done, &port]() {
+        fiberio::use_on_this_thread();
+        fiberio::server_socket server;
+        server.bind("127.0.0.1", 5504);
+        server.listen(num_clients);
+        port.set_value(server.get_port());
+        auto run_future = fibers::async([&acceptor, &server]() {
+            acceptor.run(server);
+        });
+        done.get_future().get();
+        server.close();
+        run_future.get();
+    } };
+
+    const uint16_t server_port = port.get_future().get();
+    std::vector<fiberio::socket> clients(num_clients);
+    for (auto& client : clients) {
+        client.connect("127.0.0.1", server_port);
+    }
+
+    this_fiber::sleep_for(std::chrono::microseconds{10});
+
+    time_measure measure;
+    std::vector<fibers::future<void>> futures(num_clients);
+    for (int i = 0; i < num_clients; i++) {
+        futures.at(i) = fibers::async([](fiberio::socket client) {
+            char buf[] {'a'};
+            char buf2[1];
+            for (uint64_t i = 0; i < num_iterations; i++) {
+                client.write(buf, sizeof(buf));
+                client.read_exactly(buf2, sizeof(buf2));
+            }
+            client.close();
+        }, std::move(clients.at(i)));
+    }
+    for (int i = 0; i < num_clients; i++) {
+        futures.at(i).get();
+    }
+    measure.finish(num_iterations * num_clients);
+
+    done.set_value();
+    acceptor_thread.join();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void bench_connection_churn()
+{
+    // Every iteration opens a connection, accepts it and closes both ends
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 5505);
+    server.listen(50);
+
+    const uint64_t num_iterations{ 10'000 };
+
+    auto server_future = fibers::async([&server]() {
+        for (uint64_t i = 0; i < num_iterations; i++) {
+            server.accept().close();
+        }
+    });
+
+    time_measure measure;
+    for (uint64_t i = 0; i < num_iterations; i++) {
+        fiberio::socket client;
+        client.connect(server.get_host(), server.get_port());
+        client.close();
+    }
+    server_future.get();
+    measure.finish(num_iterations);
+
+    server.close();
+}
+
+void connect_rate(const std::string& host)
+{
+    // Each connection is made, accepted and closed, one at a time
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 5510);
+    server.listen(50);
+
+    const uint64_t num_iterations{ 10'000 };
+
+    auto server_future = fibers::async([&server]() {
+        for (uint64_t i = 0; i < num_iterations; i++) {
+            server.accept().close();
+        }
+    });
+
+    time_measure measure;
+    for (uint64_t i = 0; i < num_iterations; i++) {
+        fiberio::socket client;
+        client.connect(host, 5510);
+        client.close();
+    }
+    server_future.get();
+    measure.finish(num_iterations);
+
+    server.close();
+}
+
+void bench_connect_rate_numeric()
+{
+    connect_rate("127.0.0.1");
+}
+
+void bench_connect_rate_resolver()
+{
+    // Every connect() goes to getaddrinfo() on the libuv threadpool
+    auto options = fiberio::get_dns_cache_options();
+    auto uncached = options;
+    uncached.ttl = std::chrono::milliseconds{ 0 };
+    fiberio::set_dns_cache_options(uncached);
+    connect_rate("localhost");
+    fiberio::set_dns_cache_options(options);
+}
+
+void pooled_requests(bool use_pool, uint16_t port)
+{
+    // Each request sends one byte and waits for the echo, either on a new
+    // connection or on one from a connection_pool
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", port);
+    server.listen(50);
+
+    const uint64_t num_requests{ 10'000 };
+
+    auto server_future = fibers::async([&server]() {
+        std::vector<fibers::future<void>> clients;
+        try {
+            while (true) {
+                clients.push_back(fibers::async([](fiberio::socket client) {
+                    char buf[1];
+                    while (client.read(buf, sizeof(buf)) > 0) {
+                        client.write(buf, sizeof(buf));
+                    }
+                }, server.accept()));
+            }
+        } catch (std::runtime_error& e) {
+            // The server was closed
+        }
+        for (auto& client : clients) {
+            client.get();
+        }
+    });
+
+    fiberio::connection_pool pool;
+    time_measure measure;
+    char buf[1] = { 'a' };
+    for (uint64_t i = 0; i < num_requests; i++) {
+        if (use_pool) {
+            auto connection = pool.acquire("127.0.0.1", port);
+            connection->write(buf, sizeof(buf));
+            connection->read_exactly(buf, sizeof(buf));
+            connection.release();
+        } else {
+            fiberio::socket client;
+            client.connect("127.0.0.1", port);
+            client.write(buf, sizeof(buf));
+            client.read_exactly(buf, sizeof(buf));
+            client.close();
+        }
+    }
+    measure.finish(num_requests);
+
+    pool.clear();
+    server.close();
+    server_future.get();
+}
+
+void bench_requests_without_connection_pool()
+{
+    pooled_requests(false, 5511);
+}
+
+void bench_requests_with_connection_pool()
+{
+    pooled_requests(true, 5512);
+}
+
+template<class Operation>
+void measure_operation(const char* name, uint64_t num_iterations,
+    Operation operation)
+{
+    std::cout << name << "\n";
+    const uint64_t allocations_before = allocation_count;
+    time_measure measure;
+    for (uint64_t i = 0; i < num_iterations; i++) {
+        operation();
+    }
+    measure.finish(num_iterations);
+    std::cout << "allocations per iteration: " <<
+        static_cast<double>(allocation_count - allocations_before) /
+        num_iterations << "\n";
+}
+
+void bench_socket_operations()
+{
+    // Operations that each wait for one or more libuv callbacks
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 5513);
+    server.listen(50);
+
+    const uint64_t num_iterations{ 10'000 };
+
+    auto server_future = fibers::async([&server]() {
+        for (uint64_t i = 0; i < num_iterations; i++) {
+            server.accept().close();
+        }
+    });
+
+    // Only the handle is closed, since there is no connection to shut down
+    measure_operation("open and close", num_iterations, []() {
+        fiberio::socket client;
+        client.close();
+    });
+
+    // Waits for the connect, the shutdown and the close of the handle
+    measure_operation("connect, shut down and close", num_iterations, []() {
+        fiberio::socket client;
+        client.connect("127.0.0.1", 5513);
+        client.close();
+    });
+
+    server_future.get();
+    server.close();
+}
+
+void close_connections(fiberio::socket::close_mode mode, uint16_t port)
+{
+    // Closes many open connections one after the other, like at shutdown
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", port);
+    server.listen(1024);
+
+    // Both ends need a descriptor, so this stays below the usual limits
+    const uint64_t num_connections{ 5'000 };
+
+    std::vector<fiberio::socket> clients;
+    std::vector<fiberio::socket> server_sides;
+    for (uint64_t i = 0; i < num_connections; i++) {
+        clients.emplace_back();
+        clients.back().connect("127.0.0.1", port);
+        server_sides.push_back(server.accept());
+    }
+
+    std::cout << "closing\n";
+    time_measure measure;
+    for (auto& client : clients) {
+        client.close(mode);
+    }
+    measure.finish(num_connections);
+
+    // The peers see the end of the stream (or a reset) once the loop is done
+    std::cout << "until the peers noticed\n";
+    char buf[1];
+    std::error_code ec;
+    for (auto& server_side : server_sides) {
+        server_side.read(buf, sizeof(buf), ec);
+        server_side.close(fiberio::socket::close_mode::abortive);
+    }
+    measure.finish(num_connections);
+
+    server.close();
+}
+
+void bench_close_connections_wait()
+{
+    close_connections(fiberio::socket::close_mode::wait, 5516);
+}
+
+void bench_close_connections_background()
+{
+    close_connections(fiberio::socket::close_mode::background, 5517);
+}
+
+void bench_close_connections_abortive()
+{
+    close_connections(fiberio::socket::close_mode::abortive, 5518);
+}
+
+void split_requests(bool no_delay, uint16_t port)
+{
+    // Requests and responses are written as a header and a body, which is
+    // where Nagle's algorithm and delayed ACKs wait for each other
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    if (no_delay) {
+        fiberio::tcp_options options;
+        options.no_delay = true;
+        server.set_accepted_options(options);
+    }
+    server.bind("127.0.0.1", port);
+    server.listen(50);
+
+    // Each request can stall for tens of milliseconds without no_delay
+    const uint64_t num_requests{ 50 };
+
+    auto server_future = fibers::async([&server]() {
+        auto client = server.accept();
+        char buf[2];
+        for (uint64_t i = 0; i < num_requests; i++) {
+            client.read_exactly(buf, sizeof(buf));
+            client.write(buf, 1);
+            client.write(buf + 1, 1);
+        }
+        client.close();
+    });
+
+    fiberio::socket client;
+    client.connect("127.0.0.1", port);
+    if (no_delay) {
+        fiberio::tcp_options options;
+        options.no_delay = true;
+        client.set_options(options);
+    }
+    time_measure measure;
+    char buf[2] = { 'a', 'b' };
+    for (uint64_t i = 0; i < num_requests; i++) {
+        client.write(buf, 1);
+        client.write(buf + 1, 1);
+        client.read_exactly(buf, sizeof(buf));
+    }
+    measure.finish(num_requests);
+
+    server_future.get();
+    client.close();
+    server.close();
+}
+
+void bench_split_requests_default()
+{
+    split_requests(false, 5519);
+}
+
+void bench_split_requests_no_delay()
+{
+    split_requests(true, 5520);
+}
+
+void send_file_throughput(bool use_sendfile, uint16_t port)
+{
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", port);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect("127.0.0.1", port);
+    auto server_client = server.accept();
+
+    // Every size is sent until about this much was sent in total
+    const uint64_t bytes_per_size{ 256 * 1024 * 1024 };
+    const uint64_t sizes[] = { 4 * 1024, 64 * 1024, 1024 * 1024,
+        16 * 1024 * 1024, 256 * 1024 * 1024, 1024 * 1024 * 1024 };
+    const std::size_t block_size{ 64 * 1024 };
+    std::vector<char> block(block_size, 'x');
+
+    for (uint64_t size : sizes) {
+        char path[] = "/tmp/fiberio_bench_XXXXXX";
+        int file_fd = mkstemp(path);
+        if (file_fd < 0) {
+            std::cerr << "mkstemp() failed: " << strerror(errno) << "\n";
+            std::exit(1);
+        }
+        unlink(path);
+        for (uint64_t written = 0; written < size; ) {
+            ssize_t result = ::write(file_fd, block.data(),
+                std::min<uint64_t>(size - written, block_size));
+            if (result <= 0) {
+                std::cerr << "write() failed: " << strerror(errno) << "\n";
+                std::exit(1);
+            }
+            written += result;
+        }
+        const uint64_t transfers{
+            std::max<uint64_t>(1, bytes_per_size / size) };
+
+        auto reader = fibers::async([&client, size, transfers]() {
+            std::vector<char> buf(block_size);
+            uint64_t remaining{ size * transfers };
+            while (remaining > 0) {
+                remaining -= client.read(buf.data(),
+                    std::min<uint64_t>(remaining, buf.size()));
+            }
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+        time_measure measure;
+        for (uint64_t i = 0; i < transfers; i++) {
+            if (use_sendfile) {
+                server_client.send_file(file_fd, 0, size);
+                continue;
+            }
+            for (uint64_t offset = 0; offset < size; ) {
+                ssize_t result = pread(file_fd, block.data(),
+                    std::min<uint64_t>(size - offset, block_size), offset);
+                if (result <= 0) {
+                    std::cerr << "pread() failed: " << strerror(errno) << "\n";
+                    std::exit(1);
+                }
+                server_client.write(block.data(), result);
+                offset += result;
+            }
+        }
+        reader.get();
+        const std::chrono::duration<double> elapsed{
+            std::chrono::steady_clock::now() - start };
+        std::cout << "file size: " << size / 1024 << " KiB\n";
+        measure.finish(transfers);
+        std::cout << "MiB per second: " << static_cast<long>(
+            size * transfers / elapsed.count() / (1024 * 1024)) << "\n";
+        close(file_fd);
+    }
+
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+void bench_send_file_read_write()
+{
+    send_file_throughput(false, 5521);
+}
+
+void bench_send_file_sendfile()
+{
+    send_file_throughput(true, 5522);
+}
+
+long resident_kilobytes()
+{
+    long pages = 0;
+    std::ifstream statm{ "/proc/self/statm" };
+    statm >> pages >> pages;
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double thread_cpu_seconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+void idle_connections(bool timer_wheel)
+{
+    fiberio::use_on_this_thread();
+
+    // Each connection takes two descriptors, and a single server port only
+    // has room for about 28k client ports, so several ports are used
+    const std::size_t wanted_connections{ 100'000 };
+    const uint16_t first_port{ 5506 };
+    const uint16_t num_ports{ 4 };
+    const auto timeout = std::chrono::seconds{ 60 };
+    const auto idle_time = std::chrono::seconds{ 2 };
+    const std::size_t ticks_per_second{ 10 };
+
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    const std::size_t num_connections{ std::min<std::size_t>(
+        wanted_connections, (limit.rlim_cur - 100) / 2) };
+    std::cout << "connections: " << num_connections << "\n";
+
+    std::vector<fiberio::server_socket> servers(num_ports);
+    for (uint16_t i = 0; i < num_ports; i++) {
+        servers[i].bind("127.0.0.1", first_port + i);
+        servers[i].listen(1024);
+    }
+
+    std::vector<fiberio::socket> server_clients;
+    auto server_future = fibers::async([&]() {
+        while (server_clients.size() < num_connections) {
+            for (auto& server : servers) {
+                for (auto& client : server.accept_many(
+                        num_connections - server_clients.size())) {
+                    server_clients.push_back(std::move(client));
+                }
+                if (server_clients.size() == num_connections) break;
+            }
+        }
+    });
+    std::vector<fiberio::socket> clients(num_connections);
+    for (std::size_t i = 0; i < num_connections; i++) {
+        clients[i].connect("127.0.0.1", first_port + i % num_ports);
+    }
+    server_future.get();
+
+    const long kilobytes_before{ resident_kilobytes() };
+    bool done = false;
+    dummy_lock lock;
+    fibers::condition_variable_any cond;
+    std::vector<fibers::future<void>> watchdogs;
+
+    time_measure measure;
+    for (auto& client : server_clients) {
+        if (timer_wheel) {
+            client.set_idle_timeout(timeout);
+        } else {
+            // The usual alternative, a sleeping fiber per connection
+            watchdogs.push_back(fibers::async([&, client]() mutable {
+                if (!cond.wait_for(lock, timeout, [&]() { return done; })) {
+                    client.close();
+                }
+            }));
+        }
+    }
+    measure.finish(num_connections);
+
+    std::cout << "memory per connection: " <<
+        (resident_kilobytes() - kilobytes_before) * 1024.0 / num_connections <<
+        " bytes\n";
+
+    const double cpu_before{ thread_cpu_seconds() };
+    this_fiber::sleep_for(idle_time);
+    const double cpu_seconds{ thread_cpu_seconds() - cpu_before };
+    std::cout << "cpu time per tick: " << cpu_seconds * 1000000.0 /
+        (idle_time.count() * ticks_per_second) << " us\n";
+
+    done = true;
+    cond.notify_all();
+    for (auto& watchdog : watchdogs) {
+        watchdog.get();
+    }
+    for (auto& client : clients) {
+        client.close();
+    }
+    for (auto& client : server_clients) {
+        client.close();
+    }
+    for (auto& server : servers) {
+        server.close();
+    }
+}
+
+void bench_idle_timeouts_timer_wheel()
+{
+    idle_connections(true);
+}
+
+void bench_idle_timeouts_watchdog_fibers()
+{
+    idle_connections(false);
+}
+
+void stream_small_messages(bool async)
+{
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 5503);
+    server.listen(50);
+
+    const uint64_t num_messages{ 1000'000 };
+    const char message[16] {};
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        char buf[64 * 1024];
+        while (server_client.is_open()) {
+            server_client.read(buf, sizeof(buf));
+        }
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    time_measure measure;
+    for (uint64_t i = 0; i < num_messages; i++) {
+        if (async) {
+            client.write_async(message, sizeof(message));
+        } else {
+            client.write(message, sizeof(message));
+        }
+    }
+    if (async) client.flush();
+    measure.finish(num_messages);
+
+    client.close();
+    server_future.get();
+    server.close();
+}
+
+void bench_stream_small_messages()
+{
+    stream_small_messages(false);
+}
+
+void bench_stream_small_messages_async()
+{
+    stream_small_messages(true);
+}
+
 void check_result(int result)
 {
     if (result < 0) {
@@ -115,6 +826,81 @@ void check_result(int result)
     }
 }
 
+int connect_raw_loopback(uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // Connecting over loopback finishes without waiting for accept()
+    check_result(::connect(fd, (struct sockaddr*) &addr, sizeof(addr)));
+    return fd;
+}
+
+void disconnect_storm(bool error_codes, uint16_t port)
+{
+    // Clients vanish with an RST in batches, and the server notices when a
+    // read fails, either through an exception or an error code
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", port);
+    server.listen(1024);
+
+    const uint64_t num_connections{ 10'000 };
+    const uint64_t batch_size{ 100 };
+
+    uint64_t failed_reads = 0;
+    time_measure measure;
+    for (uint64_t done = 0; done < num_connections; done += batch_size) {
+        std::vector<int> fds;
+        std::vector<fibers::future<void>> readers;
+        for (uint64_t i = 0; i < batch_size; i++) {
+            fds.push_back(connect_raw_loopback(port));
+            readers.push_back(fibers::async([&failed_reads, error_codes](
+                    fiberio::socket client) {
+                char buf[64];
+                if (error_codes) {
+                    std::error_code ec;
+                    while (client.read(buf, sizeof(buf), ec) > 0) {}
+                    if (ec) failed_reads++;
+                } else {
+                    try {
+                        while (client.read(buf, sizeof(buf)) > 0) {}
+                    } catch (fiberio::io_error& e) {
+                        failed_reads++;
+                    }
+                }
+                client.close();
+            }, server.accept()));
+        }
+        for (int fd : fds) {
+            struct linger lin{ 1, 0 };
+            check_result(::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin,
+                sizeof(lin)));
+            ::close(fd);
+        }
+        for (auto& reader : readers) {
+            reader.get();
+        }
+    }
+    measure.finish(num_connections);
+    std::cout << "failed reads: " << failed_reads << "\n";
+
+    server.close();
+}
+
+void bench_disconnect_storm_exceptions()
+{
+    disconnect_storm(false, 5514);
+}
+
+void bench_disconnect_storm_error_codes()
+{
+    disconnect_storm(true, 5515);
+}
+
 void bench_echo_one_byte_ideal_unix_socket_pair()
 {
     const uint64_t num_iterations{ 100 };
@@ -229,18 +1015,155 @@ void bench_fiber_switching()
     measure.finish(2 * num_iterations);
 }
 
-void bench_fiber_creation()
+template<class StackAllocator>
+void fiber_creation(StackAllocator allocator)
 {
     const uint64_t num_iterations{ 5000'000 };
 
     time_measure measure;
     for (uint64_t i = 0; i < num_iterations; i++) {
-        auto thread = fibers::fiber([]() {});
+        auto thread = fibers::fiber(std::allocator_arg, allocator, []() {});
         thread.join();
     }
     measure.finish(num_iterations);
 }
 
+void bench_fiber_creation()
+{
+    fiber_creation(fibers::default_stack{});
+}
+
+void bench_fiber_creation_pooled()
+{
+    fiber_creation(fiberio::pooled_stack_allocator{});
+}
+
+void bench_fiber_creation_pooled_without_guard_page()
+{
+    fiberio::stack_options options;
+    options.guard_page = false;
+    fiber_creation(fiberio::pooled_stack_allocator{ options });
+}
+
+template<class StackAllocator>
+void connection_setup(StackAllocator allocator, uint16_t port)
+{
+    // Each connection is served by a fiber of its own, like in a server, so
+    // every iteration makes a stack besides connecting, accepting and closing
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", port);
+    server.listen(50);
+
+    // Each connection leaves a port in TIME_WAIT, so not too many of them
+    const uint64_t num_connections{ 5'000 };
+
+    auto server_future = fibers::async([&server, allocator]() {
+        std::vector<fibers::future<void>> handlers;
+        handlers.reserve(num_connections);
+        for (uint64_t i = 0; i < num_connections; i++) {
+            handlers.push_back(fiberio::spawn(std::allocator_arg, allocator,
+                [](fiberio::socket client) {
+                    char c;
+                    client.read_exactly(&c, 1);
+                    client.write(&c, 1);
+                    client.close();
+                }, server.accept()));
+        }
+        for (auto& handler : handlers) {
+            handler.get();
+        }
+    });
+
+    time_measure measure;
+    char c = 'a';
+    for (uint64_t i = 0; i < num_connections; i++) {
+        fiberio::socket client;
+        client.connect("127.0.0.1", port);
+        client.write(&c, 1);
+        client.read_exactly(&c, 1);
+        client.close();
+    }
+    measure.finish(num_connections);
+
+    server_future.get();
+    server.close();
+}
+
+void bench_connection_setup()
+{
+    connection_setup(fibers::default_stack{}, 5523);
+}
+
+void bench_connection_setup_pooled()
+{
+    connection_setup(fiberio::pooled_stack_allocator{}, 5524);
+}
+
+void bench_connection_setup_pooled_without_guard_page()
+{
+    fiberio::stack_options options;
+    options.guard_page = false;
+    connection_setup(fiberio::pooled_stack_allocator{ options }, 5525);
+}
+
+
+uint64_t busy_work(uint64_t value)
+{
+    for (int i = 0; i < 1000; i++) {
+        value = value * 6364136223846793005u + 1442695040888963407u;
+    }
+    return value;
+}
+
+void bench_work_stealing_scaling()
+{
+    const uint64_t num_fibers{ 10'000 };
+    const uint64_t num_iterations{ 100 };
+    const std::uint32_t max_threads{
+        std::max(1u, std::thread::hardware_concurrency()) };
+
+    for (std::uint32_t num_threads = 1; num_threads <= max_threads;
+            num_threads++) {
+        std::cout << "threads: " << num_threads << "\n";
+
+        fibers::promise<void> done_promise;
+        fibers::shared_future<void> done{ done_promise.get_future() };
+        std::vector<std::thread> threads;
+        for (std::uint32_t t = 1; t < num_threads; t++) {
+            threads.emplace_back([num_threads, done]() {
+                fiberio::use_work_stealing_on_this_thread(num_threads);
+                done.wait();
+            });
+        }
+        fiberio::use_work_stealing_on_this_thread(num_threads);
+
+        // All fibers start out on this thread and the others steal them
+        time_measure measure;
+        std::vector<fibers::future<uint64_t>> futures(num_fibers);
+        for (uint64_t i = 0; i < num_fibers; i++) {
+            futures[i] = fibers::async([](uint64_t value) {
+                for (uint64_t j = 0; j < num_iterations; j++) {
+                    value = busy_work(value);
+                    this_fiber::yield();
+                }
+                return value;
+            }, i);
+        }
+        uint64_t sum{ 0 };
+        for (uint64_t i = 0; i < num_fibers; i++) {
+            sum += futures[i].get();
+        }
+        measure.finish(num_fibers * num_iterations);
+        if (sum == 0) std::cout << "(unlikely sum)\n";
+
+        done_promise.set_value();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
 
 void bench_thread_switching()
 {
@@ -297,6 +1220,69 @@ int main()
     std::cout << "\nbench_echo_one_byte\n";
     std::async(bench_echo_one_byte).get();
 
+    std::cout << "\nbench_echo_one_byte_streaming\n";
+    std::async(bench_echo_one_byte_streaming).get();
+
+    std::cout << "\nbench_echo_one_byte_acceptor\n";
+    std::async(bench_echo_one_byte_acceptor).get();
+
+    std::cout << "\nbench_connection_churn\n";
+    std::async(bench_connection_churn).get();
+
+    std::cout << "\nbench_connect_rate_numeric\n";
+    std::async(bench_connect_rate_numeric).get();
+
+    std::cout << "\nbench_connect_rate_resolver\n";
+    std::async(bench_connect_rate_resolver).get();
+
+    std::cout << "\nbench_requests_without_connection_pool\n";
+    std::async(bench_requests_without_connection_pool).get();
+
+    std::cout << "\nbench_requests_with_connection_pool\n";
+    std::async(bench_requests_with_connection_pool).get();
+
+    std::cout << "\nbench_socket_operations\n";
+    std::async(bench_socket_operations).get();
+
+    std::cout << "\nbench_disconnect_storm_exceptions\n";
+    std::async(bench_disconnect_storm_exceptions).get();
+
+    std::cout << "\nbench_disconnect_storm_error_codes\n";
+    std::async(bench_disconnect_storm_error_codes).get();
+
+    std::cout << "\nbench_close_connections_wait\n";
+    std::async(bench_close_connections_wait).get();
+
+    std::cout << "\nbench_close_connections_background\n";
+    std::async(bench_close_connections_background).get();
+
+    std::cout << "\nbench_close_connections_abortive\n";
+    std::async(bench_close_connections_abortive).get();
+
+    std::cout << "\nbench_split_requests_default\n";
+    std::async(bench_split_requests_default).get();
+
+    std::cout << "\nbench_split_requests_no_delay\n";
+    std::async(bench_split_requests_no_delay).get();
+
+    std::cout << "\nbench_send_file_read_write\n";
+    std::async(bench_send_file_read_write).get();
+
+    std::cout << "\nbench_send_file_sendfile\n";
+    std::async(bench_send_file_sendfile).get();
+
+    std::cout << "\nbench_idle_timeouts_timer_wheel\n";
+    std::async(bench_idle_timeouts_timer_wheel).get();
+
+    std::cout << "\nbench_idle_timeouts_watchdog_fibers\n";
+    std::async(bench_idle_timeouts_watchdog_fibers).get();
+
+    std::cout << "\nbench_stream_small_messages\n";
+    std::async(bench_stream_small_messages).get();
+
+    std::cout << "\nbench_stream_small_messages_async\n";
+    std::async(bench_stream_small_messages_async).get();
+
     std::cout << "\nbench_echo_one_byte_ideal_unix_socket_pair\n";
     std::async(bench_echo_one_byte_ideal_unix_socket_pair).get();
 
@@ -309,6 +1295,24 @@ int main()
     std::cout << "\nbench_fiber_creation\n";
     std::async(bench_fiber_creation).get();
 
+    std::cout << "\nbench_fiber_creation_pooled\n";
+    std::async(bench_fiber_creation_pooled).get();
+
+    std::cout << "\nbench_fiber_creation_pooled_without_guard_page\n";
+    std::async(bench_fiber_creation_pooled_without_guard_page).get();
+
+    std::cout << "\nbench_connection_setup\n";
+    std::async(bench_connection_setup).get();
+
+    std::cout << "\nbench_connection_setup_pooled\n";
+    std::async(bench_connection_setup_pooled).get();
+
+    std::cout << "\nbench_connection_setup_pooled_without_guard_page\n";
+    std::async(bench_connection_setup_pooled_without_guard_page).get();
+
+    std::cout << "\nbench_work_stealing_scaling\n";
+    std::async(bench_work_stealing_scaling).get();
+
     std::cout << "\nbench_thread_switching\n";
     std::async(bench_thread_switching).get();
 
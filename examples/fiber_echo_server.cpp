@@ -1,8 +1,6 @@
 #include <fiberio/all.hpp>
 #include <boost/fiber/all.hpp>
 
-namespace fibers = boost::fibers;
-
 int main()
 {
     fiberio::use_on_this_thread();
@@ -12,7 +10,7 @@ int main()
     server.listen(50);
 
     while (true) {
-        fibers::async([](fiberio::socket client) {
+        fiberio::spawn([](fiberio::socket client) {
             char buf[4096];
             while (client.is_open()) {
                 std::size_t bytes_read{ client.read(buf, sizeof(buf)) };
@@ -0,0 +1,46 @@
+#include <fiberio/all.hpp>
+#include <boost/fiber/all.hpp>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/*
+ * Like fiber_echo_server, but with one thread per core that each have their
+ * own listening socket on the same port. SO_REUSEPORT makes the OS spread the
+ * connections between them.
+ */
+
+void run_worker()
+{
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 5531, true);
+    server.listen(50);
+
+    while (true) {
+        fiberio::spawn([](fiberio::socket client) {
+            char buf[4096];
+            while (client.is_open()) {
+                std::size_t bytes_read{ client.read(buf, sizeof(buf)) };
+                client.write(buf, bytes_read);
+            }
+        }, server.accept());
+    }
+}
+
+int main()
+{
+    const unsigned thread_count{
+        std::max(1u, std::thread::hardware_concurrency()) };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < thread_count; i++) {
+        threads.emplace_back(run_worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return 0;
+}
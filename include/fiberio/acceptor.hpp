@@ -0,0 +1,74 @@
+#ifndef _FIBERIO_ACCEPTOR_H_
+#define _FIBERIO_ACCEPTOR_H_
+
+#include <fiberio/server_socket.hpp>
+#include <fiberio/socket.hpp>
+#include <memory>
+
+namespace fiberio {
+
+class acceptor_state;
+
+/*! \brief Accepts connections on one thread and hands them to other threads
+ *
+ * This is an alternative to bind() with reuse_port for when the OS spreads the
+ * load poorly, e.g. because some connections are long-lived and busy. One
+ * thread calls run() with a listening server_socket, while each worker thread
+ * calls join() once and then receive() repeatedly. All threads need to have
+ * called use_on_this_thread() first.
+ *
+ * Only the descriptor of a connection is handed over, so the data is never
+ * copied and the accepting thread never waits for a worker.
+ */
+class acceptor
+{
+public:
+    //! How run() picks the worker that gets the next connection
+    enum class policy
+    {
+        //! Each worker in turn
+        round_robin,
+        //! The worker with the fewest open connections from this acceptor
+        least_loaded
+    };
+
+    //! Creates an acceptor without any workers
+    explicit acceptor(policy p = policy::round_robin);
+
+    //! Destructor. Closes connections that no worker has received.
+    ~acceptor();
+
+    acceptor(const acceptor&) = delete;
+    acceptor& operator=(const acceptor&) = delete;
+
+    //! Registers the calling thread as a worker
+    void join();
+
+    /*! \brief Waits for the next connection handed to the calling thread
+     *
+     * The calling thread must have called join(). The socket belongs to the
+     * calling thread's loop. Throws std::runtime_error when run() has
+     * returned and there are no connections left for this thread.
+     */
+    socket receive();
+
+    /*! \brief Accepts connections from server and hands them to the workers
+     *
+     * This waits for the first worker to join if there are none. It returns
+     * when server is closed, and receive() stops waiting for connections on
+     * all workers after that.
+     *
+     * Connections that fail while being accepted are skipped, and running out
+     * of descriptors or memory pauses accepting for a while. Other errors,
+     * like calling this on another thread than the server's, are thrown as
+     * io_error, which also stops the workers.
+     */
+    void run(server_socket& server);
+
+private:
+    std::shared_ptr<acceptor_state> state_;
+};
+
+}
+
+#endif
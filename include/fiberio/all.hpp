@@ -2,8 +2,16 @@
 #define _FIBERIO_ALL_H_
 
 #include <fiberio/fiberio.hpp>
+#include <fiberio/spawn.hpp>
 #include <fiberio/socket.hpp>
+#include <fiberio/buffer_slice.hpp>
+#include <fiberio/buffer_pool.hpp>
 #include <fiberio/server_socket.hpp>
+#include <fiberio/tcp_options.hpp>
+#include <fiberio/acceptor.hpp>
+#include <fiberio/connection_pool.hpp>
+#include <fiberio/dns_cache.hpp>
+#include <fiberio/error.hpp>
 #include <fiberio/exceptions.hpp>
 #include <fiberio/iostream.hpp>
 
@@ -0,0 +1,82 @@
+#ifndef _FIBERIO_BUFFER_POOL_H_
+#define _FIBERIO_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fiberio {
+
+/*! \brief Counters for the buffer pool of the calling thread
+ *
+ * Each thread has a pool of read buffers in a number of size classes that
+ * read_string(), read_slice() and the iostream wrappers use. The reuse rate
+ * is reused / (reused + allocated).
+ */
+struct buffer_pool_stats
+{
+    //! Buffers that were handed out again from the pool
+    std::uint64_t reused;
+
+    //! Buffers that were allocated since the pool had none of the right size
+    std::uint64_t allocated;
+
+    //! Buffers that were too large for any size class and not pooled
+    std::uint64_t oversized;
+
+    //! Buffers that were freed since the pool already had enough of them
+    std::uint64_t freed;
+
+    //! Bytes of unused buffers that the pool holds on to right now
+    std::size_t cached_bytes;
+};
+
+//! Returns the counters of the calling thread's buffer pool
+buffer_pool_stats get_buffer_pool_stats();
+
+namespace detail {
+
+void* allocate_from_pool(std::size_t size);
+
+void deallocate_to_pool(void* data) noexcept;
+
+//! Allocator that takes memory from the calling thread's buffer pool
+template<class T>
+class pool_allocator
+{
+public:
+    using value_type = T;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using reference = T&;
+    using const_reference = const T&;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+
+    template<class U>
+    struct rebind { using other = pool_allocator<U>; };
+
+    pool_allocator() noexcept {}
+
+    template<class U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n, const void* = nullptr) {
+        return static_cast<T*>(allocate_from_pool(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept {
+        deallocate_to_pool(p);
+    }
+
+    template<class U>
+    bool operator==(const pool_allocator<U>&) const noexcept { return true; }
+
+    template<class U>
+    bool operator!=(const pool_allocator<U>&) const noexcept { return false; }
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _FIBERIO_BUFFER_SLICE_H_
+#define _FIBERIO_BUFFER_SLICE_H_
+
+#include <cstddef>
+
+namespace fiberio {
+
+class socket;
+
+namespace detail {
+
+//! Header of a buffer from the pool. The data follows right after it.
+struct pooled_block
+{
+    std::size_t refs;
+    std::size_t capacity;
+};
+
+}
+
+/*! \brief Read data that lives in a buffer borrowed from FiberIO's pool
+ *
+ * Copies share the same buffer, which goes back to the pool of the current
+ * thread when the last copy is destroyed. The reference count isn't atomic, so
+ * all copies must stay on one thread at a time.
+ */
+class buffer_slice
+{
+public:
+    //! Creates an empty slice
+    buffer_slice() noexcept;
+
+    //! Creates a slice sharing the buffer of another
+    buffer_slice(const buffer_slice& other) noexcept;
+
+    //! Creates a slice based on another, which will be empty after
+    buffer_slice(buffer_slice&& other) noexcept;
+
+    //! Destructor. Returns the buffer to the pool if this was the last user.
+    ~buffer_slice();
+
+    //! Copy assignment
+    buffer_slice& operator=(const buffer_slice& other) noexcept;
+
+    //! Move assignment
+    buffer_slice& operator=(buffer_slice&& other) noexcept;
+
+    const char* data() const noexcept { return data_; }
+
+    std::size_t size() const noexcept { return size_; }
+
+    bool empty() const noexcept { return size_ == 0; }
+
+    const char* begin() const noexcept { return data_; }
+
+    const char* end() const noexcept { return data_ + size_; }
+
+    //! Returns part of this slice, sharing the same buffer
+    buffer_slice subslice(std::size_t offset, std::size_t size) const;
+
+private:
+    friend class socket;
+
+    buffer_slice(detail::pooled_block* block, const char* data,
+        std::size_t size) noexcept;
+
+    void release() noexcept;
+
+    detail::pooled_block* block_;
+    const char* data_;
+    std::size_t size_;
+};
+
+}
+
+#endif
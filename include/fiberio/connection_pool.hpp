@@ -0,0 +1,127 @@
+#ifndef _FIBERIO_CONNECTION_POOL_H_
+#define _FIBERIO_CONNECTION_POOL_H_
+
+#include <fiberio/socket.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fiberio {
+
+class connection_pool_state;
+
+//! Limits of a connection_pool, which apply to each host:port separately
+struct connection_pool_options
+{
+    //! Connections that may be open at once, handed out or idle
+    std::size_t max_connections = 16;
+
+    //! Idle connections that are kept for reuse. Extra ones are closed.
+    std::size_t max_idle = 16;
+
+    //! Idle connections that weren't used for this long are closed
+    std::chrono::milliseconds idle_timeout{ 60000 };
+};
+
+//! Counters for a connection_pool, summed over all destinations
+struct connection_pool_stats
+{
+    //! Connections that were handed out again
+    std::uint64_t reused;
+
+    //! Connections that were opened
+    std::uint64_t connected;
+
+    //! Idle connections that were closed by the peer or had unread data
+    std::uint64_t dead;
+
+    //! Times that acquire() waited because max_connections were open
+    std::uint64_t waited;
+
+    //! Idle connections in the pool right now
+    std::size_t idle;
+};
+
+/*! \brief A connection handed out by a connection_pool
+ *
+ * Call release() once a request and its response are done to give the
+ * connection back for reuse. If it's destroyed without release(), e.g.
+ * because an exception left the protocol in an unknown state, the connection
+ * is closed instead.
+ */
+class pooled_socket
+{
+public:
+    //! Creates a pooled_socket without a connection
+    pooled_socket();
+
+    pooled_socket(pooled_socket&& other);
+
+    pooled_socket& operator=(pooled_socket&& other);
+
+    pooled_socket(const pooled_socket&) = delete;
+    pooled_socket& operator=(const pooled_socket&) = delete;
+
+    //! Destructor. Closes the connection unless it was released.
+    ~pooled_socket();
+
+    socket& operator*() { return socket_; }
+
+    socket* operator->() { return &socket_; }
+
+    //! Gives the connection back to the pool, which may hand it out again
+    void release();
+
+private:
+    friend class connection_pool_state;
+
+    pooled_socket(socket s, std::shared_ptr<connection_pool_state> state,
+        const std::string& key);
+
+    void give_back(bool reusable);
+
+    socket socket_;
+    std::shared_ptr<connection_pool_state> state_;
+    std::string key_;
+};
+
+/*! \brief Keeps connections to other servers open between requests
+ *
+ * acquire() hands out an idle connection to host:port if there is one, and
+ * connects otherwise. Once max_connections are open to a destination, the
+ * fiber waits for one to be released instead of connecting again. Before an
+ * idle connection is handed out, it's checked that the peer hasn't closed it.
+ *
+ * The sockets belong to the loop of the thread that created them, so each
+ * thread should have its own pool.
+ */
+class connection_pool
+{
+public:
+    explicit connection_pool(
+        const connection_pool_options& options = connection_pool_options{});
+
+    //! Destructor. Closes the idle connections.
+    ~connection_pool();
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    //! Returns a connection to host:port, waiting for one if needed
+    pooled_socket acquire(const std::string& host, uint16_t port);
+
+    //! Returns the counters of this pool
+    connection_pool_stats get_stats();
+
+    //! Closes all idle connections
+    void clear();
+
+private:
+    std::shared_ptr<connection_pool_state> state_;
+};
+
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef _FIBERIO_DNS_CACHE_H_
+#define _FIBERIO_DNS_CACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace fiberio {
+
+/*! \brief Settings for the process-wide cache of name lookups
+ *
+ * socket::connect() looks host names up through this cache, keyed on host and
+ * port. Fibers that ask for a name while it's being looked up wait for that
+ * lookup instead of starting another one, also on other threads.
+ */
+struct dns_cache_options
+{
+    //! How long a successful lookup is used. Zero turns caching off.
+    std::chrono::milliseconds ttl{ 30000 };
+
+    //! How long a failed lookup is remembered. Zero turns that off.
+    std::chrono::milliseconds negative_ttl{ 5000 };
+
+    //! Expired entries are dropped when the cache grows past this size
+    std::size_t max_entries = 1024;
+};
+
+//! Counters for the process-wide cache of name lookups
+struct dns_cache_stats
+{
+    //! Lookups that were answered with a cached address
+    std::uint64_t hits;
+
+    //! Lookups that were answered with a cached failure
+    std::uint64_t negative_hits;
+
+    //! Lookups that waited for the same lookup by another fiber
+    std::uint64_t coalesced;
+
+    //! Lookups that went to the system resolver
+    std::uint64_t misses;
+
+    //! Entries in the cache right now, including expired ones
+    std::size_t entries;
+};
+
+//! Changes the settings of the cache. Entries already cached keep their TTL.
+void set_dns_cache_options(const dns_cache_options& options);
+
+//! Returns the current settings of the cache
+dns_cache_options get_dns_cache_options();
+
+//! Forgets every cached lookup, e.g. after the network changed
+void clear_dns_cache();
+
+//! Returns the counters of the cache
+dns_cache_stats get_dns_cache_stats();
+
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _FIBERIO_ERROR_H_
+#define _FIBERIO_ERROR_H_
+
+#include <system_error>
+
+namespace fiberio {
+
+/*! \brief The category of the std::error_codes that FiberIO reports
+ *
+ * The values are libuv status codes. Those with an errno equivalent compare
+ * equal to the matching std::errc, e.g. ec == std::errc::connection_reset,
+ * and the message is the one from libuv.
+ *
+ * The overloads that report errors this way use these conditions:
+ *
+ * - std::errc::not_connected: the socket was already closed
+ * - std::errc::timed_out: the deadline or timeout passed
+ * - std::errc::operation_canceled: the server socket was closed while waiting
+ */
+const std::error_category& io_category() noexcept;
+
+}
+
+#endif
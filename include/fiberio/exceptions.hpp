@@ -20,6 +20,13 @@ public:
     socket_closed_error() : io_error{"stream closed"} {}
 };
 
+//! Thrown when an operation with a timeout or deadline didn't finish in time
+class timeout_error : public io_error
+{
+public:
+    timeout_error() : io_error{"operation timed out"} {}
+};
+
 //! Thrown when e.g. trying to use IPv6 and it's not supported on the system
 class address_family_not_supported_error : public io_error
 {
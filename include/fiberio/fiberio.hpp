@@ -6,11 +6,31 @@
  * See the namespace ::fiberio for all the documentation.
  */
 
+#include <cstdint>
+
 namespace fiberio {
 
 //! Call this first thing on a thread to use FiberIO on that thread.
 void use_on_this_thread();
 
+/*! \brief Call this first thing on each of thread_count threads to share fibers
+ *
+ * Each thread runs its own event loop, but idle threads steal ready fibers
+ * from busy ones. A fiber that uses a socket is bound to the thread whose loop
+ * owns that socket and is moved there if it's running somewhere else. Fibers
+ * that never touch sockets can run on any of the threads.
+ *
+ * Only using a socket binds a fiber. Copying or destroying one doesn't, and
+ * since copies share a reference count that isn't atomic, that must not
+ * happen on another thread than the socket's. A new fiber may start on any of
+ * the threads, so move sockets into new fibers and use them there before
+ * copying or dropping them.
+ *
+ * All the threads must call this with the same thread_count. Start a new group
+ * of threads only after all threads in the previous group have joined it.
+ */
+void use_work_stealing_on_this_thread(std::uint32_t thread_count);
+
 }
 
 #endif
@@ -2,6 +2,7 @@
 #define _FIBERIO_IOSTREAM_HPP_
 
 #include <fiberio/socket.hpp>
+#include <fiberio/buffer_pool.hpp>
 #include <iostream>
 #include <memory>
 #include <boost/iostreams/concepts.hpp>
@@ -55,17 +56,21 @@ private:
 /*! \brief std::basic_iostream type for reading/writing to a socket
  *
  * Takes a fiberio::socket as constructor argument. See the C++ standard for how
- * to use a basic_iostream and Boost.IOStreams for implementation details.
+ * to use a basic_iostream and Boost.IOStreams for implementation details. The
+ * stream's buffers come from the thread's buffer pool.
  */
-using socket_stream = boost::iostreams::stream<fiberio::detail::socket_device>;
+using socket_stream = boost::iostreams::stream<fiberio::detail::socket_device,
+    std::char_traits<char>, fiberio::detail::pool_allocator<char>>;
 
 /*! \brief std::basic_streambuf type for reading/writing to a socket
  *
  * Takes a fiberio::socket as constructor argument. See the C++ standard for how
- * to use a basic_streambuf and Boost.IOStreams for implementation details.
+ * to use a basic_streambuf and Boost.IOStreams for implementation details. The
+ * stream's buffers come from the thread's buffer pool.
  */
 using socket_streambuf =
-    boost::iostreams::stream_buffer<fiberio::detail::socket_device>;
+    boost::iostreams::stream_buffer<fiberio::detail::socket_device,
+        std::char_traits<char>, fiberio::detail::pool_allocator<char>>;
 
 }
 
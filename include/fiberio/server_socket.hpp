@@ -2,8 +2,11 @@
 #define _FIBERIO_SERVER_SOCKET_H_
 
 #include <fiberio/socket.hpp>
+#include <fiberio/tcp_options.hpp>
 #include <memory>
 #include <string>
+#include <system_error>
+#include <vector>
 #include <cstdint>
 
 namespace fiberio {
@@ -29,8 +32,13 @@ public:
      * check what it's actually bound to after.
      *
      * A port of 0 will bind to any available port.
+     *
+     * With reuse_port, the socket gets SO_REUSEPORT so that several
+     * server_sockets (typically one per thread) can bind to the same address
+     * and port. The OS then spreads new connections between them. All of them
+     * need reuse_port for this to work.
      */
-    void bind(const std::string& host, uint16_t port);
+    void bind(const std::string& host, uint16_t port, bool reuse_port = false);
 
     //! Return the host that the server_socket is bound to
     std::string get_host();
@@ -46,6 +54,26 @@ public:
      */
     void listen(int backlog);
 
+    /*! \brief Tunes the listening socket
+     *
+     * Takes effect once the server_socket is bound, so call it before listen()
+     * (or before bind()). Throws fiberio::io_error if an option couldn't be
+     * set.
+     */
+    void set_listen_options(const listen_options& options);
+
+    /*! \brief Tunes the connections that arrive from now on
+     *
+     * The options that the OS copies from the listening socket to the sockets
+     * it accepts are set on the listening socket, so accepting costs no extra
+     * system calls for them. On Linux, that's all of them except quick_ack,
+     * which is set on each accepted connection. Call it before listen() (or
+     * before bind()) to cover every connection.
+     *
+     * Throws fiberio::io_error if an option couldn't be set.
+     */
+    void set_accepted_options(const tcp_options& options);
+
     /*! \brief Accept an incoming connection and get a socket representing it
      *
      * This is typically done repeatedly.
@@ -55,10 +83,46 @@ public:
      */
     socket accept();
 
+    /*! \brief Accepts like accept() but gives up at the deadline
+     *
+     * Throws fiberio::timeout_error if no connection arrived in time. The
+     * server_socket keeps listening.
+     */
+    socket accept(std::chrono::steady_clock::time_point deadline);
+
+    //! Accepts like accept() but gives up after timeout
+    socket accept(std::chrono::milliseconds timeout);
+
+    /*! \brief Accepts like accept() but reports failures in ec
+     *
+     * Nothing is thrown. If the server_socket is closed while waiting, ec is
+     * std::errc::operation_canceled. On failure, the returned socket isn't
+     * connected, like one from socket().
+     */
+    socket accept(std::error_code& ec);
+
+    //! Accepts like accept(ec) but gives up at the deadline
+    socket accept(std::chrono::steady_clock::time_point deadline,
+        std::error_code& ec);
+
+    /*! \brief Accept all pending connections, but at most max of them
+     *
+     * Waits like accept() until there is at least one connection and then
+     * takes every other connection that is waiting in the backlog too, so
+     * that a storm of new connections needs fewer wakeups.
+     *
+     * If the OS reported an error for an incoming connection (such as running
+     * out of file descriptors), this throws io_error once for that error.
+     * accept() does the same.
+     */
+    std::vector<socket> accept_many(std::size_t max);
+
     //! Close the listening socket and stop listening for connections
     void close();
 
 private:
+    friend class acceptor;
+
     std::unique_ptr<server_socket_impl> impl_;
 };
 
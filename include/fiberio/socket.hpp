@@ -1,30 +1,131 @@
 #ifndef _FIBERIO_SOCKET_H_
 #define _FIBERIO_SOCKET_H_
 
+#include <fiberio/buffer_slice.hpp>
+#include <fiberio/error.hpp>
+#include <fiberio/tcp_options.hpp>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
 #include <memory>
 #include <string>
+#include <system_error>
 
 namespace fiberio {
 
 class socket_impl;
 
+void intrusive_ptr_add_ref(socket_impl* impl);
+
+void intrusive_ptr_release(socket_impl* impl);
+
+//! A buffer to read into, for vectored reads
+struct mutable_buffer
+{
+    char* data;
+    std::size_t size;
+};
+
+//! A buffer to write from, for vectored writes
+struct const_buffer
+{
+    const char* data;
+    std::size_t size;
+};
+
+/*! \brief An open connection that isn't owned by any thread
+ *
+ * Created by socket::detach(). It can be moved to another thread, where
+ * constructing a socket from it attaches the connection to that thread's loop.
+ * The connection is closed if it's destroyed without being attached.
+ */
+class detached_socket
+{
+public:
+    //! Creates an empty detached_socket without a connection
+    detached_socket();
+
+    //! Takes over the connection of another, which will be empty after
+    detached_socket(detached_socket&& other);
+
+    //! Destructor. Closes the connection if it wasn't attached.
+    ~detached_socket();
+
+    //! Move assignment
+    detached_socket& operator=(detached_socket&& other);
+
+    //! Returns true if this doesn't hold a connection
+    bool empty() const { return fd_ < 0; }
+
+    /*! \brief Returns the descriptor of the connection, or -1 if empty
+     *
+     * It stays owned by the detached_socket, but can be used to inspect or
+     * set socket options that fiberio doesn't cover.
+     */
+    int native_handle() const { return fd_; }
+
+private:
+    friend class socket_impl;
+
+    int fd_;
+    bool streaming_;
+    std::size_t stream_buf_size_;
+    // Data that had been read from the connection but not by the user
+    std::string buffered_;
+};
+
 //! Client socket for communicating over a network and opening connections
 class socket
 {
 public:
     static constexpr std::size_t DEFAULT_BUF_SIZE = 256 * 1024;
 
+    static constexpr std::size_t DEFAULT_STREAM_BUF_SIZE = 64 * 1024;
+
+    static constexpr std::size_t DEFAULT_WRITE_QUEUE_LIMIT = 1024 * 1024;
+
+    static constexpr std::size_t MAX_SLICE_SIZE = 64 * 1024;
+
+    //! A send_file() length that sends everything from offset to the end
+    static constexpr std::uint64_t TO_END_OF_FILE = ~std::uint64_t{ 0 };
+
+    //! How a connection is closed
+    enum class close_mode
+    {
+        //! Shuts the connection down and waits until it's closed
+        wait,
+        //! Shuts the connection down in the background and returns at once
+        background,
+        //! Resets the connection and returns at once, dropping unsent data
+        abortive
+    };
+
     //! Creates a non-connected socket
     socket();
 
-    //! Creates a socket based on another
+    /*! \brief Creates a socket sharing the connection of another
+     *
+     * The copies share a reference count that isn't atomic, so all of them
+     * have to stay on one thread at a time. With work stealing, that's the
+     * thread of the socket's loop; see use_work_stealing_on_this_thread().
+     * Use detach() to move a connection to another thread.
+     */
     socket(const socket&);
 
     //! Creates a socket based on another, which will be invalid after
     socket(socket&&);
 
     //! For internal use only
-    socket(std::shared_ptr<socket_impl>&& impl);
+    socket(boost::intrusive_ptr<socket_impl>&& impl);
+
+    /*! \brief Attaches a detached connection to the calling thread's loop
+     *
+     * The socket continues where the detached one left off. Streaming stays
+     * enabled if it was, and data that had already been received is returned
+     * by the first reads.
+     */
+    explicit socket(detached_socket&& detached);
 
     //! Destructor. Closes the socket if still open.
     ~socket();
@@ -35,9 +136,38 @@ public:
     //! Move assignment
     socket& operator=(socket&& other);
 
-    //! Connects to host:port and throws an exception on failure.
+    /*! \brief Connects to host:port and throws an exception on failure.
+     *
+     * If host has several addresses, they are tried in parallel with a short
+     * delay between them, alternating between IPv6 and IPv4 (RFC 8305). The
+     * first connection that is established is used.
+     */
     void connect(const std::string& host, uint16_t port);
 
+    /*! \brief Connects like connect() but gives up at the deadline
+     *
+     * Throws fiberio::timeout_error if the connection wasn't established in
+     * time. The socket is closed in that case.
+     */
+    void connect(const std::string& host, uint16_t port,
+        std::chrono::steady_clock::time_point deadline);
+
+    //! Connects like connect() but gives up after timeout
+    void connect(const std::string& host, uint16_t port,
+        std::chrono::milliseconds timeout);
+
+    /*! \brief Connects like connect() but reports failures in ec
+     *
+     * Nothing is thrown when the connection fails, e.g. because it was
+     * refused, so failing is as cheap as succeeding. See io_category() for
+     * the error codes. ec is cleared on success.
+     */
+    void connect(const std::string& host, uint16_t port, std::error_code& ec);
+
+    //! Connects like connect(host, port, ec) but gives up at the deadline
+    void connect(const std::string& host, uint16_t port,
+        std::chrono::steady_clock::time_point deadline, std::error_code& ec);
+
     /*! \brief Reads up to size bytes into buf.
      *
      * Throws an exception on failure. fiberio::socket_closed_error is thrown
@@ -46,9 +176,57 @@ public:
      */
     std::size_t read(char* buf, std::size_t size);
 
+    /*! \brief Reads like read() but gives up at the deadline
+     *
+     * Throws fiberio::timeout_error if no data arrived in time. Nothing is
+     * lost then, and the socket can be read from again.
+     */
+    std::size_t read(char* buf, std::size_t size,
+        std::chrono::steady_clock::time_point deadline);
+
+    //! Reads like read() but gives up after timeout
+    std::size_t read(char* buf, std::size_t size,
+        std::chrono::milliseconds timeout);
+
+    /*! \brief Reads like read() but reports failures in ec
+     *
+     * Nothing is thrown, e.g. if the peer reset the connection or the socket
+     * was already closed. The end of the stream returns 0 and leaves ec clear,
+     * like read() does.
+     */
+    std::size_t read(char* buf, std::size_t size, std::error_code& ec);
+
+    //! Reads like read(buf, size, ec) but gives up at the deadline
+    std::size_t read(char* buf, std::size_t size,
+        std::chrono::steady_clock::time_point deadline, std::error_code& ec);
+
     //! The same as read() but always fills the buffer completely (or fails)
     void read_exactly(char* buf, std::size_t size);
 
+    /*! \brief Fills the buffer like read_exactly() unless the deadline passes
+     *
+     * Throws fiberio::timeout_error if the buffer isn't full in time. The data
+     * that was read before that is in the buffer, but how much there is isn't
+     * known, so the stream is usually not worth reading from afterwards.
+     */
+    void read_exactly(char* buf, std::size_t size,
+        std::chrono::steady_clock::time_point deadline);
+
+    //! Fills the buffer like read_exactly() unless timeout passes
+    void read_exactly(char* buf, std::size_t size,
+        std::chrono::milliseconds timeout);
+
+    /*! \brief Reads up to the total size of count buffers, in order
+     *
+     * This works like read(), but once the first non-empty buffer is full it
+     * also fills the following buffers with any data that is already available
+     * without waiting for more.
+     */
+    std::size_t read(const mutable_buffer* bufs, std::size_t count);
+
+    //! The same as the vectored read() but always fills all the buffers
+    void read_exactly(const mutable_buffer* bufs, std::size_t count);
+
     /*! \brief Reads up to count bytes and returns it as an std::string
      *
      * Allocates a buffer of size count. If shrink_to_fit is true, it will
@@ -63,18 +241,166 @@ public:
     //! The same as read_string() but reads exactly count bytes (or fails)
     std::string read_string_exactly(std::size_t count);
 
+    /*! \brief Reads up to max_size bytes into a buffer from FiberIO's pool
+     *
+     * The data is read straight into a pooled buffer, so nothing is allocated
+     * or copied in the common case. The buffer goes back to the pool when the
+     * last copy of the slice is destroyed. max_size is capped to
+     * MAX_SLICE_SIZE.
+     *
+     * This works the same as read() except that it returns a slice. An empty
+     * slice means that the socket was closed.
+     */
+    buffer_slice read_slice(std::size_t max_size = MAX_SLICE_SIZE);
+
     //! Writes data from the buffer and returns once the buffer can be freed
     void write(const char* data, std::size_t len);
 
+    /*! \brief Writes like write() but gives up at the deadline
+     *
+     * Throws fiberio::timeout_error if the data couldn't be handed to the OS
+     * in time, e.g. because the peer stopped reading. Part of it may have been
+     * sent already, so the socket is closed in that case.
+     */
+    void write(const char* data, std::size_t len,
+        std::chrono::steady_clock::time_point deadline);
+
+    //! Writes like write() but gives up after timeout
+    void write(const char* data, std::size_t len,
+        std::chrono::milliseconds timeout);
+
+    //! Writes like write() but reports failures in ec instead of throwing
+    void write(const char* data, std::size_t len, std::error_code& ec);
+
+    //! Writes like write(data, len, ec) but gives up at the deadline
+    void write(const char* data, std::size_t len,
+        std::chrono::steady_clock::time_point deadline, std::error_code& ec);
+
     //! Writes data from the buffer and returns once the buffer can be freed
     void write(const std::string& data);
 
+    /*! \brief Writes count buffers, in order, with a single vectored write
+     *
+     * Returns once all the buffers can be freed.
+     */
+    void write(const const_buffer* bufs, std::size_t count);
+
+    //! Writes the buffers, e.g. write({{header, 4}, {payload, size}})
+    void write(std::initializer_list<const_buffer> bufs);
+
+    /*! \brief Sends length bytes of an open file, starting at offset
+     *
+     * The kernel moves the data from the page cache to the connection with
+     * sendfile(2), so it isn't copied through user memory. Like write(), this
+     * returns once all of it was handed to the OS, and data queued with
+     * write_async() goes first. Returns the number of bytes sent, which is
+     * only less than length for TO_END_OF_FILE.
+     *
+     * Throws fiberio::io_error if the file ends before the range does. The
+     * file is read on the thread's loop, so files that aren't cached stall the
+     * thread while they are read from disk. The file's own offset isn't
+     * changed.
+     */
+    std::uint64_t send_file(int file_fd, std::uint64_t offset = 0,
+        std::uint64_t length = TO_END_OF_FILE);
+
+    //! Opens the file at path and sends it like send_file(file_fd, ...)
+    std::uint64_t send_file(const std::string& path, std::uint64_t offset = 0,
+        std::uint64_t length = TO_END_OF_FILE);
+
+    /*! \brief Queues data for writing and usually returns without waiting
+     *
+     * Data that can't be written right away is copied and written in the
+     * background, in order with other writes. This only waits if more than
+     * the write queue limit would be queued. A failed background write is
+     * reported by a later write or flush() call, as fiberio::io_error like
+     * other write errors.
+     */
+    void write_async(const char* data, std::size_t len);
+
+    //! The same as write_async() but takes ownership of the data
+    void write_async(std::string&& data);
+
+    //! Waits until all queued writes are done (throws io_error if any failed)
+    void flush();
+
+    /*! \brief Sets how many bytes write_async() may queue before waiting
+     *
+     * A single write larger than this is still queued once nothing else is.
+     */
+    void set_write_queue_limit(std::size_t bytes);
+
+    /*! \brief Keeps the socket registered for reading between read calls
+     *
+     * When enabled, incoming data is buffered in a ring buffer of buffer_size
+     * bytes as soon as it arrives and read() (and everything built on it)
+     * returns buffered data without suspending the fiber. Reading from the
+     * connection pauses while the buffer is full.
+     *
+     * Disabling it stops reading from the connection, but data that is
+     * already buffered is still returned by the following reads.
+     */
+    void set_streaming(bool enabled,
+        std::size_t buffer_size = DEFAULT_STREAM_BUF_SIZE);
+
+    /*! \brief Tunes the connection, e.g. turns Nagle's algorithm off
+     *
+     * Only the fields that aren't left at their defaults are set. This needs
+     * a connection, so call it after connect(). Throws fiberio::io_error if an
+     * option couldn't be set.
+     */
+    void set_options(const tcp_options& options);
+
+    /*! \brief Shuts the connection down after timeout without reads or writes
+     *
+     * Every read and write call counts as activity and restarts the timeout.
+     * When it expires, the connection is shut down in both directions. Reads
+     * then see the end of the stream (so a waiting read returns and closes the
+     * socket) and writes fail. The timeout has a granularity of 100 ms, and a
+     * timeout of zero turns it off.
+     *
+     * The timeouts of all sockets on a thread share one timer wheel, so this
+     * costs no fiber or timer per socket.
+     */
+    void set_idle_timeout(std::chrono::milliseconds timeout);
+
+    /*! \brief Detaches the connection from the calling thread's loop
+     *
+     * Waits for queued writes first, so that nothing that was written is lost.
+     * No other fiber may use the socket while this runs. After this, the
+     * socket (and all its copies) is closed, while the connection lives on in
+     * the returned detached_socket.
+     */
+    detached_socket detach();
+
     /*! \brief Closes the socket if it's not already closed.
      *
      * It's safe to call this repeatedly as it's idempotent.
      */
     void close();
 
+    /*! \brief Closes the socket like close(), in the given way
+     *
+     * With close_mode::background and close_mode::abortive, the fiber isn't
+     * suspended. The socket counts as closed right away, and the loop finishes
+     * the job and frees the socket afterwards. A background close still sends
+     * the data queued by write_async() before the end of the stream. An
+     * abortive close sends an RST instead (SO_LINGER with a zero timeout),
+     * which also keeps the port out of TIME_WAIT.
+     *
+     * A background close that is still sending data when the thread exits is
+     * abandoned.
+     */
+    void close(close_mode mode);
+
+    /*! \brief Sets how the connection is closed if the socket is dropped open
+     *
+     * This applies when the last copy of the socket is destroyed without
+     * close(). The default is close_mode::wait, which suspends the fiber that
+     * destroys the socket until the connection is closed.
+     */
+    void set_close_mode_on_destroy(close_mode mode);
+
     /*! \brief Check if the connection is open
      *
      * This starts out true and changes when the socket is closed or discovers
@@ -83,7 +409,9 @@ public:
     bool is_open();
 
 private:
-    std::shared_ptr<socket_impl> impl_;
+    friend class connection_pool_state;
+
+    boost::intrusive_ptr<socket_impl> impl_;
 };
 
 
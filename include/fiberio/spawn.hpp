@@ -0,0 +1,81 @@
+#ifndef _FIBERIO_SPAWN_H_
+#define _FIBERIO_SPAWN_H_
+
+#include <boost/context/stack_context.hpp>
+#include <boost/fiber/future.hpp>
+#include <boost/fiber/policy.hpp>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace fiberio {
+
+//! How the stacks from a pooled_stack_allocator are set up
+struct stack_options
+{
+    //! Usable size of each stack in bytes (0 means Boost's default size)
+    std::size_t size = 0;
+
+    /*! \brief Asks the OS to back the stacks with transparent huge pages
+     *
+     * The stack is then rounded up to a multiple of the huge page size, so
+     * this only makes sense for large stacks. It has no effect unless THP is
+     * set to "madvise" or "always".
+     */
+    bool huge_pages = false;
+
+    //! Puts an inaccessible page below each stack to catch overflows
+    bool guard_page = true;
+};
+
+/*! \brief Stack allocator for Boost.Fiber that reuses stacks on each thread
+ *
+ * Stacks of finished fibers go to a free list of the thread they finished on
+ * instead of back to the OS, so starting a fiber usually doesn't need a
+ * system call. Stacks with different options are kept apart.
+ *
+ * Can be passed to boost::fibers::fiber and boost::fibers::async with
+ * std::allocator_arg, or used through spawn().
+ */
+class pooled_stack_allocator
+{
+public:
+    explicit pooled_stack_allocator(const stack_options& options = {});
+
+    boost::context::stack_context allocate();
+
+    void deallocate(boost::context::stack_context& sctx) noexcept;
+
+private:
+    std::size_t size_;
+    bool huge_pages_;
+    bool guard_page_;
+};
+
+/*! \brief Starts a fiber that calls fn(args...) on a stack from the pool
+ *
+ * This works like boost::fibers::async() and returns a future for the result,
+ * which may be ignored. The stack comes from a pooled_stack_allocator with
+ * the default options.
+ */
+template<class Fn, class... Args>
+auto spawn(Fn&& fn, Args&&... args)
+{
+    return boost::fibers::async(boost::fibers::launch::post,
+        std::allocator_arg, pooled_stack_allocator{},
+        std::forward<Fn>(fn), std::forward<Args>(args)...);
+}
+
+//! The same as spawn(), but with a specific stack allocator
+template<class StackAllocator, class Fn, class... Args>
+auto spawn(std::allocator_arg_t, StackAllocator&& salloc, Fn&& fn,
+    Args&&... args)
+{
+    return boost::fibers::async(boost::fibers::launch::post,
+        std::allocator_arg, std::forward<StackAllocator>(salloc),
+        std::forward<Fn>(fn), std::forward<Args>(args)...);
+}
+
+}
+
+#endif
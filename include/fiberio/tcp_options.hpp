@@ -0,0 +1,77 @@
+#ifndef _FIBERIO_TCP_OPTIONS_H_
+#define _FIBERIO_TCP_OPTIONS_H_
+
+#include <chrono>
+
+namespace fiberio {
+
+/*! \brief Tuning of a TCP connection
+ *
+ * Fields that are left at their defaults aren't applied, so the connection
+ * keeps the OS defaults for them. Options that the system doesn't support
+ * fail with an io_error when they are set.
+ */
+struct tcp_options
+{
+    //! Sends small writes right away instead of combining them (TCP_NODELAY)
+    bool no_delay = false;
+
+    /*! \brief Probes the peer after the connection was idle for this long
+     *
+     * Turns on SO_KEEPALIVE and sets TCP_KEEPIDLE, so that dead peers are
+     * noticed. Zero leaves keepalive off.
+     */
+    std::chrono::seconds keepalive_idle{ 0 };
+
+    //! Time between keepalive probes (TCP_KEEPINTVL). Zero keeps the default.
+    std::chrono::seconds keepalive_interval{ 0 };
+
+    //! Unanswered probes before the connection is dropped (TCP_KEEPCNT)
+    int keepalive_count = 0;
+
+    /*! \brief Size of the kernel's send buffer in bytes (SO_SNDBUF)
+     *
+     * Linux doubles the value to make room for its bookkeeping, and stops
+     * growing the buffer on demand once it's set.
+     */
+    int send_buffer_size = 0;
+
+    //! Size of the kernel's receive buffer in bytes (SO_RCVBUF)
+    int receive_buffer_size = 0;
+
+    /*! \brief Acknowledges received data right away (TCP_QUICKACK)
+     *
+     * Linux only. The kernel goes back to delayed ACKs on its own later on,
+     * so this helps most at the start of a connection.
+     */
+    bool quick_ack = false;
+
+    /*! \brief Busy polls the device for this long before sleeping on reads
+     *
+     * Sets SO_BUSY_POLL (Linux only). Raising it above the system default
+     * needs CAP_NET_ADMIN.
+     */
+    std::chrono::microseconds busy_poll{ 0 };
+};
+
+//! Tuning of a listening socket, which doesn't apply to single connections
+struct listen_options
+{
+    /*! \brief Only accepts a connection once the client has sent data
+     *
+     * Sets TCP_DEFER_ACCEPT (Linux only) to this timeout, after which the
+     * connection is accepted anyway. Zero turns it off.
+     */
+    std::chrono::seconds defer_accept{ 0 };
+
+    /*! \brief Accepts data in the SYN from clients that use TCP Fast Open
+     *
+     * Sets TCP_FASTOPEN to this queue length, which limits the connections
+     * that haven't finished the handshake yet. Zero turns it off.
+     */
+    int fast_open_queue = 0;
+};
+
+}
+
+#endif
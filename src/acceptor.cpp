@@ -0,0 +1,242 @@
+#include <fiberio/acceptor.hpp>
+#include <fiberio/exceptions.hpp>
+#include "server_socket_impl.hpp"
+#include "socket_impl.hpp"
+#include <boost/fiber/all.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace fibers = boost::fibers;
+namespace this_fiber = boost::this_fiber;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+// At most this many connections are taken from the backlog per wakeup
+const std::size_t ACCEPT_BATCH_SIZE = 64;
+
+// How long accepting pauses when the system runs out of resources, doubling
+// up to the maximum while it lasts
+const std::chrono::milliseconds MIN_ACCEPT_BACKOFF{ 1 };
+const std::chrono::milliseconds MAX_ACCEPT_BACKOFF{ 100 };
+
+//! True for failures that only cost the connection being accepted
+bool is_connection_error(int status)
+{
+    return status == UV_ECONNABORTED || status == UV_ECONNRESET ||
+        status == UV_EPROTO || status == UV_EPERM;
+}
+
+//! True for running out of something that is likely to be freed again soon
+bool is_resource_error(int status)
+{
+    return status == UV_EMFILE || status == UV_ENFILE ||
+        status == UV_ENOBUFS || status == UV_ENOMEM;
+}
+
+}
+
+//! The connections that have been handed to one worker thread
+class acceptor_worker
+{
+public:
+    acceptor_worker()
+        : thread_id_{ std::this_thread::get_id() },
+          open_{ std::make_shared<std::atomic<std::size_t>>(0) },
+          stopped_{false}
+    {}
+
+    ~acceptor_worker() {
+        for (auto fd : fds_) {
+            ::close(fd);
+        }
+    }
+
+    std::thread::id get_thread_id() const { return thread_id_; }
+
+    //! Connections that were handed to this worker and are still open
+    std::size_t get_load() const { return open_->load(); }
+
+    void push(uv_os_sock_t fd) {
+        open_->fetch_add(1);
+        {
+            std::unique_lock<fibers::mutex> lock{ mutex_ };
+            fds_.push_back(fd);
+        }
+        cond_.notify_one();
+    }
+
+    void stop() {
+        {
+            std::unique_lock<fibers::mutex> lock{ mutex_ };
+            stopped_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    socket receive() {
+        uv_os_sock_t fd;
+        {
+            std::unique_lock<fibers::mutex> lock{ mutex_ };
+            while (fds_.empty() && !stopped_) {
+                cond_.wait(lock);
+            }
+            if (fds_.empty()) throw std::runtime_error("acceptor stopped");
+            fd = fds_.front();
+            fds_.pop_front();
+        }
+        // The socket_impl is created here, so it belongs to this thread's loop
+        auto new_socket_impl = make_socket_impl();
+        new_socket_impl->set_open_counter(open_);
+        new_socket_impl->do_open(fd);
+        return socket{ std::move(new_socket_impl) };
+    }
+
+private:
+    std::thread::id thread_id_;
+    std::shared_ptr<std::atomic<std::size_t>> open_;
+    fibers::mutex mutex_;
+    fibers::condition_variable cond_;
+    std::deque<uv_os_sock_t> fds_;
+    bool stopped_;
+};
+
+class acceptor_state
+{
+public:
+    acceptor_state(acceptor::policy policy)
+        : policy_{policy}, next_{0}
+    {}
+
+    void join() {
+        {
+            std::unique_lock<fibers::mutex> lock{ mutex_ };
+            workers_.push_back(std::make_shared<acceptor_worker>());
+        }
+        cond_.notify_all();
+    }
+
+    std::shared_ptr<acceptor_worker> get_this_worker() {
+        std::unique_lock<fibers::mutex> lock{ mutex_ };
+        for (auto& worker : workers_) {
+            if (worker->get_thread_id() == std::this_thread::get_id()) {
+                return worker;
+            }
+        }
+        throw std::logic_error("thread hasn't joined the acceptor");
+    }
+
+    void wait_for_workers() {
+        std::unique_lock<fibers::mutex> lock{ mutex_ };
+        while (workers_.empty()) {
+            cond_.wait(lock);
+        }
+    }
+
+    void dispatch(const std::vector<uv_os_sock_t>& fds) {
+        std::unique_lock<fibers::mutex> lock{ mutex_ };
+        for (auto fd : fds) {
+            pick_worker().push(fd);
+        }
+    }
+
+    void stop_workers() {
+        std::unique_lock<fibers::mutex> lock{ mutex_ };
+        for (auto& worker : workers_) {
+            worker->stop();
+        }
+    }
+
+private:
+    acceptor_worker& pick_worker() {
+        if (policy_ == acceptor::policy::least_loaded) {
+            acceptor_worker* best = workers_.front().get();
+            for (auto& worker : workers_) {
+                if (worker->get_load() < best->get_load()) {
+                    best = worker.get();
+                }
+            }
+            return *best;
+        }
+        next_ = (next_ + 1) % workers_.size();
+        return *workers_[next_];
+    }
+
+    acceptor::policy policy_;
+    std::size_t next_;
+    fibers::mutex mutex_;
+    fibers::condition_variable cond_;
+    std::vector<std::shared_ptr<acceptor_worker>> workers_;
+};
+
+acceptor::acceptor(policy p)
+    : state_{ std::make_shared<acceptor_state>(p) }
+{
+}
+
+acceptor::~acceptor()
+{
+}
+
+void acceptor::join()
+{
+    state_->join();
+}
+
+socket acceptor::receive()
+{
+    return state_->get_this_worker()->receive();
+}
+
+void acceptor::run(server_socket& server)
+{
+    state_->wait_for_workers();
+    try {
+        auto backoff = MIN_ACCEPT_BACKOFF;
+        while (true) {
+            std::error_code ec;
+            auto fds = server.impl_->accept_fds(ACCEPT_BATCH_SIZE, ec);
+            if (!fds.empty()) {
+                if (DEBUG_LOG) std::cout << "handing out " << fds.size() <<
+                    " connections\n";
+                state_->dispatch(fds);
+            }
+            if (!ec) {
+                backoff = MIN_ACCEPT_BACKOFF;
+                continue;
+            }
+            const int status = ec.value();
+            if (DEBUG_LOG) std::cout << "accept error: " << ec.message() <<
+                "\n";
+            if (status == UV_ECANCELED) {
+                if (DEBUG_LOG) std::cout << "server_socket was closed\n";
+                break;
+            } else if (is_connection_error(status)) {
+                // A failed connection doesn't stop the others
+                this_fiber::yield();
+            } else if (is_resource_error(status)) {
+                this_fiber::sleep_for(backoff);
+                backoff = std::min(backoff * 2, MAX_ACCEPT_BACKOFF);
+            } else {
+                throw_if_error(ec);
+            }
+        }
+    } catch (...) {
+        state_->stop_workers();
+        throw;
+    }
+    state_->stop_workers();
+}
+
+}
@@ -10,19 +10,37 @@ namespace fiberio {
 
 namespace {
 
+struct addrinfo_request
+{
+    completion_slot slot;
+    struct addrinfo* result = nullptr;
+};
+
 void addrinfo_callback(uv_getaddrinfo_t* req, int status, struct addrinfo* res)
 {
     void* data = uv_req_get_data((uv_req_t*) req);
-    fibers::promise<struct addrinfo*>* promise =
-        static_cast<fibers::promise<struct addrinfo*>*>(data);
-    try {
-        check_uv_status(status);
-        promise->set_value(res);
-    } catch (std::exception& e) {
-        promise->set_exception(std::current_exception());
-    }
+    addrinfo_request* request = static_cast<addrinfo_request*>(data);
+    request->result = res;
+    request->slot.complete(status);
+}
+
 }
 
+bool parse_ip_address(const std::string& host, uint16_t port,
+    struct sockaddr_storage& addr)
+{
+    // Only IPv6 addresses contain ':', and IPv4 addresses are only digits and
+    // dots, so host names are usually rejected without parsing
+    if (host.empty()) return false;
+    if (host.find(':') != std::string::npos) {
+        return uv_ip6_addr(host.c_str(), port,
+            reinterpret_cast<struct sockaddr_in6*>(&addr)) == 0;
+    }
+    if (host.find_first_not_of("0123456789.") != std::string::npos) {
+        return false;
+    }
+    return uv_ip4_addr(host.c_str(), port,
+        reinterpret_cast<struct sockaddr_in*>(&addr)) == 0;
 }
 
 addrinfo_ptr getaddrinfo(const std::string& host, uint16_t port)
@@ -32,18 +50,19 @@ addrinfo_ptr getaddrinfo(const std::string& host, uint16_t port)
 
 addrinfo_ptr getaddrinfo(const std::string& node, const std::string& service)
 {
-    fibers::promise<struct addrinfo*> promise;
+    addrinfo_request request;
 
     uv_getaddrinfo_t req;
-    uv_req_set_data((uv_req_t*) &req, &promise);
+    uv_req_set_data((uv_req_t*) &req, &request);
 
     int status = uv_getaddrinfo(get_uv_loop(), &req, addrinfo_callback,
         node.c_str(), service.c_str(), 0);
     check_uv_status(status);
 
-    struct addrinfo* res = promise.get_future().get();
-
-    return addrinfo_ptr(res, uv_freeaddrinfo);
+    status = request.slot.wait();
+    addrinfo_ptr res(request.result, uv_freeaddrinfo);
+    check_uv_status(status);
+    return res;
 }
 
 }
@@ -15,6 +15,23 @@ addrinfo_ptr getaddrinfo(const std::string& host, uint16_t port);
 
 addrinfo_ptr getaddrinfo(const std::string& node, const std::string& service);
 
+/*! \brief Parses host as an IPv4 or IPv6 address without resolving it
+ *
+ * Returns false if host isn't a numeric address. Numeric addresses don't need
+ * getaddrinfo(), so this avoids a trip through the libuv threadpool.
+ */
+bool parse_ip_address(const std::string& host, uint16_t port,
+    struct sockaddr_storage& addr);
+
+using shared_addrinfo = std::shared_ptr<const struct addrinfo>;
+
+/*! \brief Looks host up through the process-wide DNS cache
+ *
+ * Concurrent lookups of the same host and port share one getaddrinfo() call.
+ * Failures are thrown as uv_error, like getaddrinfo() does.
+ */
+shared_addrinfo resolve(const std::string& host, uint16_t port);
+
 }
 
 #endif
@@ -0,0 +1,78 @@
+#include <fiberio/buffer_slice.hpp>
+#include "loop.hpp"
+#include <stdexcept>
+
+namespace fiberio {
+
+buffer_slice::buffer_slice() noexcept
+    : block_{nullptr}, data_{nullptr}, size_{0}
+{
+}
+
+buffer_slice::buffer_slice(detail::pooled_block* block, const char* data,
+    std::size_t size) noexcept
+    : block_{block}, data_{data}, size_{size}
+{
+}
+
+buffer_slice::buffer_slice(const buffer_slice& other) noexcept
+    : block_{other.block_}, data_{other.data_}, size_{other.size_}
+{
+    if (block_) block_->refs++;
+}
+
+buffer_slice::buffer_slice(buffer_slice&& other) noexcept
+    : block_{other.block_}, data_{other.data_}, size_{other.size_}
+{
+    other.block_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+buffer_slice::~buffer_slice()
+{
+    release();
+}
+
+buffer_slice& buffer_slice::operator=(const buffer_slice& other) noexcept
+{
+    if (other.block_) other.block_->refs++;
+    release();
+    block_ = other.block_;
+    data_ = other.data_;
+    size_ = other.size_;
+    return *this;
+}
+
+buffer_slice& buffer_slice::operator=(buffer_slice&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+        other.block_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+buffer_slice buffer_slice::subslice(std::size_t offset, std::size_t size) const
+{
+    if (offset > size_ || size > size_ - offset) {
+        throw std::out_of_range("buffer_slice::subslice");
+    }
+    if (block_) block_->refs++;
+    return buffer_slice{ block_, data_ + offset, size };
+}
+
+void buffer_slice::release() noexcept
+{
+    if (block_ && --block_->refs == 0) {
+        release_pooled_block(block_);
+    }
+    block_ = nullptr;
+}
+
+}
@@ -0,0 +1,234 @@
+#include <fiberio/connection_pool.hpp>
+#include "socket_impl.hpp"
+#include "utils.hpp"
+#include <boost/fiber/all.hpp>
+#include <deque>
+#include <iostream>
+#include <unordered_map>
+
+namespace fibers = boost::fibers;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+using clock = std::chrono::steady_clock;
+
+struct idle_connection
+{
+    socket connection;
+    clock::time_point since;
+};
+
+//! The connections to one host:port
+struct pool_destination
+{
+    //! Most recently released last
+    std::deque<idle_connection> idle;
+    //! Connections that are handed out, idle or being connected
+    std::size_t open = 0;
+    fibers::condition_variable_any cond;
+};
+
+}
+
+class connection_pool_state
+{
+public:
+    connection_pool_state(const connection_pool_options& options)
+        : options_(options), stats_{}, closed_{false}
+    {}
+
+    pooled_socket acquire(const std::shared_ptr<connection_pool_state>& self,
+        const std::string& host, uint16_t port) {
+        std::string key = host + ":" + std::to_string(port);
+        auto& destination = destinations_[key];
+        close_expired(destination);
+        dummy_lock lock;
+        bool waited = false;
+        while (true) {
+            while (!destination.idle.empty()) {
+                // The most recently used one is the likeliest to be alive
+                socket connection = take_idle(destination);
+                if (connection.impl_->is_idle_and_alive()) {
+                    if (DEBUG_LOG) std::cout << "reusing connection to " <<
+                        key << "\n";
+                    stats_.reused++;
+                    return pooled_socket{ std::move(connection), self, key };
+                }
+                if (DEBUG_LOG) std::cout << "idle connection to " << key <<
+                    " is dead\n";
+                stats_.dead++;
+                close_connection(destination, connection);
+            }
+            if (destination.open < options_.max_connections) {
+                destination.open++;
+                socket connection;
+                try {
+                    connection.connect(host, port);
+                } catch (...) {
+                    destination.open--;
+                    destination.cond.notify_one();
+                    throw;
+                }
+                if (DEBUG_LOG) std::cout << "connected to " << key << "\n";
+                stats_.connected++;
+                return pooled_socket{ std::move(connection), self, key };
+            }
+            if (!waited) {
+                if (DEBUG_LOG) std::cout << "waiting for connection to " <<
+                    key << "\n";
+                stats_.waited++;
+                waited = true;
+            }
+            destination.cond.wait(lock);
+        }
+    }
+
+    void give_back(const std::string& key, socket& connection,
+        bool reusable) {
+        auto& destination = destinations_[key];
+        if (reusable && !closed_ && connection.is_open() &&
+                destination.idle.size() < options_.max_idle) {
+            destination.idle.push_back(
+                idle_connection{ std::move(connection), clock::now() });
+        } else {
+            close_connection(destination, connection);
+        }
+        destination.cond.notify_one();
+    }
+
+    connection_pool_stats get_stats() {
+        connection_pool_stats stats = stats_;
+        stats.idle = 0;
+        for (auto& entry : destinations_) {
+            stats.idle += entry.second.idle.size();
+        }
+        return stats;
+    }
+
+    void clear() {
+        for (auto& entry : destinations_) {
+            auto& destination = entry.second;
+            while (!destination.idle.empty()) {
+                socket connection = take_idle(destination);
+                close_connection(destination, connection);
+            }
+            destination.cond.notify_all();
+        }
+    }
+
+    //! Connections that are released after this are closed
+    void shut_down() {
+        closed_ = true;
+        clear();
+    }
+
+private:
+    socket take_idle(pool_destination& destination) {
+        socket connection = std::move(destination.idle.back().connection);
+        destination.idle.pop_back();
+        return connection;
+    }
+
+    void close_connection(pool_destination& destination, socket& connection) {
+        // This runs from ~pooled_socket, so it may neither throw nor wait
+        destination.open--;
+        try {
+            connection.close(socket::close_mode::background);
+        } catch (io_error& e) {
+            if (DEBUG_LOG) std::cout << "failed to close connection: " <<
+                e.what() << "\n";
+        }
+    }
+
+    void close_expired(pool_destination& destination) {
+        auto now = clock::now();
+        while (!destination.idle.empty() &&
+                now - destination.idle.front().since >= options_.idle_timeout) {
+            if (DEBUG_LOG) std::cout << "closing expired connection\n";
+            socket connection = std::move(destination.idle.front().connection);
+            destination.idle.pop_front();
+            close_connection(destination, connection);
+        }
+    }
+
+    connection_pool_options options_;
+    std::unordered_map<std::string, pool_destination> destinations_;
+    connection_pool_stats stats_;
+    bool closed_;
+};
+
+pooled_socket::pooled_socket()
+{
+}
+
+pooled_socket::pooled_socket(socket s,
+    std::shared_ptr<connection_pool_state> state, const std::string& key)
+    : socket_{ std::move(s) }, state_{ std::move(state) }, key_{ key }
+{
+}
+
+pooled_socket::pooled_socket(pooled_socket&& other)
+    : socket_{ std::move(other.socket_) }, state_{ std::move(other.state_) },
+      key_{ std::move(other.key_) }
+{
+}
+
+pooled_socket& pooled_socket::operator=(pooled_socket&& other)
+{
+    if (this != &other) {
+        give_back(false);
+        socket_ = std::move(other.socket_);
+        state_ = std::move(other.state_);
+        key_ = std::move(other.key_);
+    }
+    return *this;
+}
+
+pooled_socket::~pooled_socket()
+{
+    give_back(false);
+}
+
+void pooled_socket::release()
+{
+    give_back(true);
+}
+
+void pooled_socket::give_back(bool reusable)
+{
+    if (state_) {
+        state_->give_back(key_, socket_, reusable);
+        state_.reset();
+    }
+}
+
+connection_pool::connection_pool(const connection_pool_options& options)
+    : state_{ std::make_shared<connection_pool_state>(options) }
+{
+}
+
+connection_pool::~connection_pool()
+{
+    state_->shut_down();
+}
+
+pooled_socket connection_pool::acquire(const std::string& host, uint16_t port)
+{
+    return state_->acquire(state_, host, port);
+}
+
+connection_pool_stats connection_pool::get_stats()
+{
+    return state_->get_stats();
+}
+
+void connection_pool::clear()
+{
+    state_->clear();
+}
+
+}
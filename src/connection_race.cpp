@@ -0,0 +1,259 @@
+#include "connection_race.hpp"
+#include "loop.hpp"
+#include <boost/fiber/all.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace fibers = boost::fibers;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+// The delay between attempts that RFC 8305 recommends
+const std::chrono::milliseconds CONNECTION_ATTEMPT_DELAY{ 250 };
+
+socklen_t get_addr_length(const struct sockaddr_storage& addr)
+{
+    return addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) :
+        sizeof(struct sockaddr_in);
+}
+
+class connection_race;
+
+//! One connection attempt, closed and freed from the loop
+struct connect_attempt
+{
+    uv_poll_t poll;
+    uv_os_sock_t fd;
+    connection_race* race;
+};
+
+void on_attempt_closed(uv_handle_t* handle)
+{
+    connect_attempt* attempt =
+        static_cast<connect_attempt*>(uv_handle_get_data(handle));
+    if (attempt->fd >= 0) ::close(attempt->fd);
+    delete attempt;
+}
+
+void on_attempt_writable(uv_poll_t* handle, int status, int);
+
+class connection_race
+{
+public:
+    connection_race(const std::vector<struct sockaddr_storage>& addrs)
+        : loop_{ get_uv_loop() }, addrs_(addrs), next_{0}, winner_{-1},
+          error_{0}, failed_{false}
+    {}
+
+    ~connection_race() {
+        stop_attempts();
+        if (winner_ >= 0) ::close(winner_);
+    }
+
+    connection_race(const connection_race&) = delete;
+    connection_race& operator=(const connection_race&) = delete;
+
+    //! Returns -1 and sets ec if there's no connection
+    uv_os_sock_t run(const deadline& until, std::error_code& ec) {
+        dummy_lock lock;
+        auto last_start = std::chrono::steady_clock::now();
+        start_next();
+        while (winner_ < 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (next_ < addrs_.size() && (attempts_.empty() || failed_ ||
+                    now >= last_start + CONNECTION_ATTEMPT_DELAY)) {
+                // A failed attempt makes way for the next one right away
+                failed_ = false;
+                last_start = now;
+                start_next();
+                continue;
+            }
+            if (attempts_.empty()) break;
+            deadline wake_up = until;
+            if (next_ < addrs_.size()) {
+                wake_up = std::min(until,
+                    last_start + CONNECTION_ATTEMPT_DELAY);
+            }
+            wait_until(cond_, lock, wake_up);
+            if (winner_ < 0 && std::chrono::steady_clock::now() >= until) {
+                if (DEBUG_LOG) std::cout << "connection race timed out\n";
+                ec = make_io_error_code(UV_ETIMEDOUT);
+                return -1;
+            }
+        }
+        stop_attempts();
+        if (winner_ < 0) {
+            ec = make_io_error_code(error_);
+            return -1;
+        }
+        uv_os_sock_t fd = winner_;
+        winner_ = -1;
+        return fd;
+    }
+
+    void on_writable(connect_attempt* attempt, int status) {
+        if (status == 0) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (::getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, &error,
+                    &length) < 0) {
+                error = errno;
+            }
+            if (error != 0) status = uv_translate_sys_error(error);
+        }
+        if (status < 0) {
+            if (DEBUG_LOG) std::cout << "connection attempt failed: " <<
+                uv_err_name(status) << "\n";
+            error_ = status;
+            failed_ = true;
+        } else if (winner_ < 0) {
+            if (DEBUG_LOG) std::cout << "connection attempt succeeded\n";
+            winner_ = attempt->fd;
+            attempt->fd = -1;
+        }
+        close_attempt(attempt);
+        cond_.notify_all();
+    }
+
+private:
+    void start_next() {
+        const struct sockaddr_storage& addr = addrs_[next_++];
+        if (DEBUG_LOG) std::cout << "starting connection attempt " <<
+            next_ << " of " << addrs_.size() << "\n";
+        uv_os_sock_t fd = ::socket(addr.ss_family,
+            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            error_ = uv_translate_sys_error(errno);
+            failed_ = true;
+            return;
+        }
+        int result;
+        do {
+            result = ::connect(fd, (const struct sockaddr*) &addr,
+                get_addr_length(addr));
+        } while (result < 0 && errno == EINTR);
+        if (result == 0) {
+            winner_ = fd;
+            return;
+        }
+        if (errno != EINPROGRESS) {
+            error_ = uv_translate_sys_error(errno);
+            failed_ = true;
+            ::close(fd);
+            return;
+        }
+        connect_attempt* attempt = new connect_attempt;
+        attempt->fd = fd;
+        attempt->race = this;
+        int status = uv_poll_init_socket(loop_, &attempt->poll, fd);
+        if (status < 0) {
+            ::close(fd);
+            delete attempt;
+            error_ = status;
+            failed_ = true;
+            return;
+        }
+        uv_handle_set_data((uv_handle_t*) &attempt->poll, attempt);
+        attempts_.push_back(attempt);
+        status = uv_poll_start(&attempt->poll, UV_WRITABLE,
+            on_attempt_writable);
+        if (status < 0) {
+            close_attempt(attempt);
+            error_ = status;
+            failed_ = true;
+        }
+    }
+
+    void close_attempt(connect_attempt* attempt) {
+        attempts_.erase(std::find(attempts_.begin(), attempts_.end(),
+            attempt));
+        // The descriptor is closed in the callback, once libuv let go of it
+        uv_close((uv_handle_t*) &attempt->poll, on_attempt_closed);
+    }
+
+    void stop_attempts() {
+        while (!attempts_.empty()) {
+            close_attempt(attempts_.back());
+        }
+    }
+
+    uv_loop_t* loop_;
+    const std::vector<struct sockaddr_storage>& addrs_;
+    std::size_t next_;
+    std::vector<connect_attempt*> attempts_;
+    fibers::condition_variable_any cond_;
+    uv_os_sock_t winner_;
+    int error_;
+    bool failed_;
+};
+
+void on_attempt_writable(uv_poll_t* handle, int status, int)
+{
+    connect_attempt* attempt = static_cast<connect_attempt*>(
+        uv_handle_get_data((uv_handle_t*) handle));
+    attempt->race->on_writable(attempt, status);
+}
+
+bool same_address(const struct sockaddr_storage& a,
+    const struct sockaddr_storage& b)
+{
+    return a.ss_family == b.ss_family &&
+        std::memcmp(&a, &b, get_addr_length(a)) == 0;
+}
+
+}
+
+std::vector<struct sockaddr_storage> connection_candidates(
+    const struct addrinfo* addrs)
+{
+    std::vector<struct sockaddr_storage> first_family;
+    std::vector<struct sockaddr_storage> other_family;
+    int family = AF_UNSPEC;
+    for (auto addr = addrs; addr; addr = addr->ai_next) {
+        if (addr->ai_family != AF_INET && addr->ai_family != AF_INET6) continue;
+        if (addr->ai_socktype != 0 && addr->ai_socktype != SOCK_STREAM) {
+            continue;
+        }
+        if (family == AF_UNSPEC) family = addr->ai_family;
+        struct sockaddr_storage storage;
+        std::memset(&storage, 0, sizeof(storage));
+        std::memcpy(&storage, addr->ai_addr, addr->ai_addrlen);
+        auto& list = addr->ai_family == family ? first_family : other_family;
+        auto duplicate = std::find_if(list.begin(), list.end(),
+            [&storage](const struct sockaddr_storage& other) {
+                return same_address(storage, other);
+            });
+        if (duplicate == list.end()) list.push_back(storage);
+    }
+    std::vector<struct sockaddr_storage> candidates;
+    for (std::size_t i = 0;
+            i < std::max(first_family.size(), other_family.size()); i++) {
+        if (i < first_family.size()) candidates.push_back(first_family[i]);
+        if (i < other_family.size()) candidates.push_back(other_family[i]);
+    }
+    return candidates;
+}
+
+uv_os_sock_t race_connections(
+    const std::vector<struct sockaddr_storage>& addrs, const deadline& until,
+    std::error_code& ec)
+{
+    ec.clear();
+    if (addrs.empty()) {
+        ec = make_io_error_code(UV_EAI_NODATA);
+        return -1;
+    }
+    connection_race race{ addrs };
+    return race.run(until, ec);
+}
+
+}
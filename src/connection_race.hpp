@@ -0,0 +1,34 @@
+#ifndef _FIBERIO_SRC_CONNECTION_RACE_H_
+#define _FIBERIO_SRC_CONNECTION_RACE_H_
+
+#include "utils.hpp"
+#include <vector>
+#include <uv.h>
+
+namespace fiberio {
+
+/*! \brief The distinct TCP addresses of a lookup, in the order to try them
+ *
+ * Address families alternate, starting with the family of the first result,
+ * as RFC 8305 recommends. Duplicates (one per socket type) are dropped.
+ */
+std::vector<struct sockaddr_storage> connection_candidates(
+    const struct addrinfo* addrs);
+
+/*! \brief Connects to the first of addrs that answers (RFC 8305)
+ *
+ * A new attempt starts every CONNECTION_ATTEMPT_DELAY, or as soon as one
+ * fails, while the earlier ones keep going. The first connection that is
+ * established wins and the others are cancelled. Returns its descriptor, which
+ * no loop owns yet.
+ *
+ * If there's no connection, returns -1 and sets ec to the status of the last
+ * failed attempt, or to UV_ETIMEDOUT if the deadline passed first.
+ */
+uv_os_sock_t race_connections(
+    const std::vector<struct sockaddr_storage>& addrs, const deadline& until,
+    std::error_code& ec);
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include <fiberio/dns_cache.hpp>
+#include "addrinfo.hpp"
+#include "utils.hpp"
+#include <boost/fiber/all.hpp>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fibers = boost::fibers;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+using clock = std::chrono::steady_clock;
+
+struct dns_cache_entry
+{
+    fibers::shared_future<shared_addrinfo> result;
+    clock::time_point expires;
+    bool pending;
+    std::uint64_t id;
+};
+
+/*! \brief Lookups of all threads, keyed on host and port
+ *
+ * The mutex is never held while a fiber waits, so it's a plain std::mutex.
+ * A pending entry holds the future of a lookup that is still running.
+ */
+class dns_cache
+{
+public:
+    dns_cache() : next_id_{0}, stats_{} {}
+
+    shared_addrinfo resolve(const std::string& host, uint16_t port) {
+        std::string key = host;
+        key += '\0';
+        key += std::to_string(port);
+
+        fibers::promise<shared_addrinfo> promise;
+        fibers::shared_future<shared_addrinfo> result;
+        std::uint64_t id;
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            auto now = clock::now();
+            auto it = entries_.find(key);
+            if (it != entries_.end() &&
+                    (it->second.pending || now < it->second.expires)) {
+                auto& entry = it->second;
+                if (entry.pending) {
+                    stats_.coalesced++;
+                } else if (entry.result.get_exception_ptr()) {
+                    stats_.negative_hits++;
+                } else {
+                    stats_.hits++;
+                }
+                result = entry.result;
+                id = 0;
+            } else {
+                if (it == entries_.end()) make_room(now);
+                stats_.misses++;
+                id = ++next_id_;
+                result = promise.get_future().share();
+                entries_[key] = dns_cache_entry{ result, now, true, id };
+            }
+        }
+        if (id == 0) {
+            if (DEBUG_LOG) std::cout << "using cached lookup of " << host <<
+                "\n";
+            return result.get();
+        }
+
+        if (DEBUG_LOG) std::cout << "looking up " << host << "\n";
+        clock::duration ttl = clock::duration::zero();
+        try {
+            auto addr = getaddrinfo(host, port);
+            promise.set_value(shared_addrinfo{ addr.release(),
+                uv_freeaddrinfo });
+            ttl = options_ttl(false);
+        } catch (uv_error& e) {
+            promise.set_exception(std::current_exception());
+            if (is_cacheable_failure(e.get_status())) ttl = options_ttl(true);
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+        finish(key, id, ttl);
+        return result.get();
+    }
+
+    void set_options(const dns_cache_options& options) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        options_ = options;
+    }
+
+    dns_cache_options get_options() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return options_;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        // Pending lookups stay so that their waiters are still coalesced
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->second.pending) {
+                ++it;
+            } else {
+                it = entries_.erase(it);
+            }
+        }
+    }
+
+    dns_cache_stats get_stats() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        dns_cache_stats stats = stats_;
+        stats.entries = entries_.size();
+        return stats;
+    }
+
+private:
+    /*! \brief Failures that are remembered for negative_ttl
+     *
+     * Temporary resolver failures count too, so that a resolver that is down
+     * isn't asked again by every connecting fiber.
+     */
+    static bool is_cacheable_failure(int status) {
+        return status != UV_ECANCELED && status != UV_EAI_CANCELED &&
+            status != UV_EAI_MEMORY && status != UV_ENOMEM;
+    }
+
+    clock::duration options_ttl(bool negative) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return negative ? options_.negative_ttl : options_.ttl;
+    }
+
+    void finish(const std::string& key, std::uint64_t id,
+        clock::duration ttl) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        auto it = entries_.find(key);
+        if (it == entries_.end() || it->second.id != id) return;
+        if (ttl <= clock::duration::zero()) {
+            entries_.erase(it);
+        } else {
+            it->second.pending = false;
+            it->second.expires = clock::now() + ttl;
+        }
+    }
+
+    //! Drops expired entries, or all finished ones if that isn't enough
+    void make_room(clock::time_point now) {
+        if (entries_.size() < options_.max_entries) return;
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (!it->second.pending && it->second.expires <= now) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (entries_.size() < options_.max_entries) return;
+        if (DEBUG_LOG) std::cout << "dns cache is full\n";
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (!it->second.pending) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, dns_cache_entry> entries_;
+    dns_cache_options options_;
+    std::uint64_t next_id_;
+    dns_cache_stats stats_;
+};
+
+dns_cache& get_dns_cache()
+{
+    // Never destroyed, so that lookups during static destruction still work
+    static dns_cache* cache = new dns_cache;
+    return *cache;
+}
+
+}
+
+shared_addrinfo resolve(const std::string& host, uint16_t port)
+{
+    return get_dns_cache().resolve(host, port);
+}
+
+void set_dns_cache_options(const dns_cache_options& options)
+{
+    get_dns_cache().set_options(options);
+}
+
+dns_cache_options get_dns_cache_options()
+{
+    return get_dns_cache().get_options();
+}
+
+void clear_dns_cache()
+{
+    get_dns_cache().clear();
+}
+
+dns_cache_stats get_dns_cache_stats()
+{
+    return get_dns_cache().get_stats();
+}
+
+}
@@ -0,0 +1,41 @@
+#include <fiberio/error.hpp>
+#include <string>
+#include <uv.h>
+
+namespace fiberio {
+
+namespace {
+
+// libuv's own codes, such as UV_EOF and the getaddrinfo errors, start here.
+// The ones above it are negated errno values.
+const int FIRST_UV_SPECIFIC_STATUS = -3000;
+
+class io_category_impl : public std::error_category
+{
+public:
+    const char* name() const noexcept override {
+        return "fiberio";
+    }
+
+    std::string message(int status) const override {
+        return uv_strerror(status);
+    }
+
+    std::error_condition default_error_condition(
+        int status) const noexcept override {
+        if (status < 0 && status > FIRST_UV_SPECIFIC_STATUS) {
+            return std::error_condition{ -status, std::generic_category() };
+        }
+        return std::error_condition{ status, *this };
+    }
+};
+
+}
+
+const std::error_category& io_category() noexcept
+{
+    static const io_category_impl category;
+    return category;
+}
+
+}
@@ -1,5 +1,6 @@
 #include <fiberio/fiberio.hpp>
 #include "scheduler.hpp"
+#include "work_stealing_scheduler.hpp"
 
 namespace fibers = boost::fibers;
 
@@ -10,4 +11,10 @@ void use_on_this_thread()
     fibers::use_scheduling_algorithm<fiberio::scheduler>();
 }
 
+void use_work_stealing_on_this_thread(std::uint32_t thread_count)
+{
+    fibers::use_scheduling_algorithm<fiberio::work_stealing_scheduler>(
+        thread_count);
+}
+
 }
@@ -1,8 +1,11 @@
 #include "loop.hpp"
+#include "timer_wheel.hpp"
 #include "utils.hpp"
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <new>
+#include <vector>
 
 namespace fiberio {
 
@@ -10,6 +13,154 @@ namespace {
 
 constexpr bool DEBUG_LOG = false;
 
+// Size classes are powers of two from 2^MIN_CLASS_SHIFT to 2^MAX_CLASS_SHIFT
+constexpr std::size_t MIN_CLASS_SHIFT = 12;
+constexpr std::size_t MAX_CLASS_SHIFT = 20;
+constexpr std::size_t NUM_CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+// Each size class keeps at most this many bytes of unused blocks
+constexpr std::size_t MAX_CACHED_BYTES_PER_CLASS = 4 * 1024 * 1024;
+
+// At most this many unused socket_impl objects are kept per thread
+constexpr std::size_t MAX_CACHED_SOCKETS = 1024;
+
+// Blocks released after the thread's pool is gone are freed directly
+thread_local bool buffer_pool_destroyed = false;
+
+thread_local bool socket_pool_destroyed = false;
+
+detail::pooled_block* allocate_block(std::size_t capacity)
+{
+    void* memory = ::operator new(sizeof(detail::pooled_block) + capacity);
+    detail::pooled_block* block = static_cast<detail::pooled_block*>(memory);
+    block->capacity = capacity;
+    return block;
+}
+
+void free_block(detail::pooled_block* block)
+{
+    ::operator delete(static_cast<void*>(block));
+}
+
+std::size_t class_size(std::size_t size_class)
+{
+    return std::size_t{1} << (size_class + MIN_CLASS_SHIFT);
+}
+
+//! Returns the smallest size class that fits size, or NUM_CLASSES if none
+std::size_t size_class_for(std::size_t size)
+{
+    std::size_t size_class = 0;
+    while (size_class < NUM_CLASSES && class_size(size_class) < size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+class buffer_pool
+{
+public:
+    buffer_pool()
+        : stats_{}
+    {}
+
+    ~buffer_pool() {
+        for (auto& free_blocks : free_blocks_) {
+            for (auto block : free_blocks) {
+                free_block(block);
+            }
+        }
+        buffer_pool_destroyed = true;
+    }
+
+    detail::pooled_block* acquire(std::size_t size) {
+        detail::pooled_block* block;
+        const std::size_t size_class = size_class_for(size);
+        if (size_class == NUM_CLASSES) {
+            if (DEBUG_LOG) std::cout << "allocating oversized block\n";
+            stats_.oversized++;
+            block = allocate_block(size);
+        } else if (free_blocks_[size_class].empty()) {
+            if (DEBUG_LOG) std::cout << "allocating pooled block\n";
+            stats_.allocated++;
+            block = allocate_block(class_size(size_class));
+        } else {
+            stats_.reused++;
+            block = free_blocks_[size_class].back();
+            free_blocks_[size_class].pop_back();
+            stats_.cached_bytes -= block->capacity;
+        }
+        block->refs = 1;
+        return block;
+    }
+
+    void release(detail::pooled_block* block) {
+        // Blocks from other threads are fine, since the capacity is exact
+        const std::size_t size_class = size_class_for(block->capacity);
+        if (size_class < NUM_CLASSES &&
+                class_size(size_class) == block->capacity &&
+                (free_blocks_[size_class].size() + 1) * block->capacity <=
+                    MAX_CACHED_BYTES_PER_CLASS) {
+            free_blocks_[size_class].push_back(block);
+            stats_.cached_bytes += block->capacity;
+        } else {
+            stats_.freed++;
+            free_block(block);
+        }
+    }
+
+    const buffer_pool_stats& get_stats() const {
+        return stats_;
+    }
+
+private:
+    std::vector<detail::pooled_block*> free_blocks_[NUM_CLASSES];
+    buffer_pool_stats stats_;
+};
+
+//! Free list for the memory of socket_impl objects, which all have one size
+class socket_pool
+{
+public:
+    socket_pool()
+        : size_{0}
+    {}
+
+    ~socket_pool() {
+        for (auto storage : free_) {
+            ::operator delete(storage);
+        }
+        socket_pool_destroyed = true;
+    }
+
+    void* allocate(std::size_t size) {
+        if (size == size_ && !free_.empty()) {
+            void* storage = free_.back();
+            free_.pop_back();
+            return storage;
+        }
+        if (DEBUG_LOG) std::cout << "allocating socket storage\n";
+        // Reserved here, since deallocate() runs in operator delete, which
+        // may not throw
+        if (free_.capacity() == 0) free_.reserve(MAX_CACHED_SOCKETS);
+        return ::operator new(size);
+    }
+
+    void deallocate(void* storage, std::size_t size) noexcept {
+        if (size_ == 0) size_ = size;
+        if (size == size_ && free_.size() < MAX_CACHED_SOCKETS &&
+                free_.size() < free_.capacity()) {
+            free_.push_back(storage);
+        } else {
+            ::operator delete(storage);
+        }
+    }
+
+private:
+    std::size_t size_;
+    std::vector<void*> free_;
+};
+
 class thread_uv_loop
 {
 public:
@@ -26,6 +177,7 @@ public:
             if (DEBUG_LOG) {
                 std::cout << "destroying uv loop\n";
             }
+            timer_wheel_.close();
             close_handle((uv_handle_t*) &async_);
             close_handle((uv_handle_t*) &timer_);
             uv_loop_close(&loop_);
@@ -62,9 +214,24 @@ public:
         make_ready();
         return &async_;
     }
+
+    buffer_pool& get_buffer_pool() {
+        return buffer_pool_;
+    }
+
+    socket_pool& get_socket_pool() {
+        return socket_pool_;
+    }
+
+    timer_wheel& get_timer_wheel() {
+        return timer_wheel_;
+    }
 private:
+    buffer_pool buffer_pool_;
+    socket_pool socket_pool_;
     bool ready_;
     uv_loop_t loop_;
+    timer_wheel timer_wheel_;
     uv_timer_t timer_;
     uv_async_t async_;
 };
@@ -88,4 +255,62 @@ uv_async_t* get_scheduler_async()
     return thread_loop.get_async();
 }
 
+detail::pooled_block* acquire_pooled_block(std::size_t size)
+{
+    if (buffer_pool_destroyed) {
+        detail::pooled_block* block = allocate_block(size);
+        block->refs = 1;
+        return block;
+    }
+    return thread_loop.get_buffer_pool().acquire(size);
+}
+
+void release_pooled_block(detail::pooled_block* block)
+{
+    if (buffer_pool_destroyed) {
+        free_block(block);
+    } else {
+        thread_loop.get_buffer_pool().release(block);
+    }
+}
+
+timer_wheel* get_timer_wheel()
+{
+    return &thread_loop.get_timer_wheel();
+}
+
+void* allocate_socket_storage(std::size_t size)
+{
+    if (socket_pool_destroyed) return ::operator new(size);
+    return thread_loop.get_socket_pool().allocate(size);
+}
+
+void free_socket_storage(void* storage, std::size_t size) noexcept
+{
+    if (socket_pool_destroyed) {
+        ::operator delete(storage);
+    } else {
+        thread_loop.get_socket_pool().deallocate(storage, size);
+    }
+}
+
+buffer_pool_stats get_buffer_pool_stats()
+{
+    return thread_loop.get_buffer_pool().get_stats();
+}
+
+namespace detail {
+
+void* allocate_from_pool(std::size_t size)
+{
+    return get_block_data(acquire_pooled_block(size));
+}
+
+void deallocate_to_pool(void* data) noexcept
+{
+    release_pooled_block(static_cast<pooled_block*>(data) - 1);
+}
+
+}
+
 }
@@ -1,6 +1,10 @@
 #ifndef _FIBERIO_SRC_LOOP_H_
 #define _FIBERIO_SRC_LOOP_H_
 
+#include <fiberio/buffer_slice.hpp>
+#include <fiberio/buffer_pool.hpp>
+#include <cstddef>
+#include <memory>
 #include <uv.h>
 
 namespace fiberio {
@@ -11,6 +15,42 @@ uv_timer_t* get_scheduler_timer();
 
 uv_async_t* get_scheduler_async();
 
+class timer_wheel;
+
+//! The timer wheel for coarse timeouts on this thread's loop
+timer_wheel* get_timer_wheel();
+
+/*! \brief Takes a block of at least size bytes from this thread's pool
+ *
+ * The block is allocated if the pool has none of the right size class. It
+ * starts out with refs == 1.
+ */
+detail::pooled_block* acquire_pooled_block(std::size_t size);
+
+//! Returns a block to the pool of the calling thread
+void release_pooled_block(detail::pooled_block* block);
+
+//! Takes memory for a socket_impl from this thread's free list
+void* allocate_socket_storage(std::size_t size);
+
+//! Puts the memory of a socket_impl on the calling thread's free list
+void free_socket_storage(void* storage, std::size_t size) noexcept;
+
+inline char* get_block_data(detail::pooled_block* block) {
+    return reinterpret_cast<char*>(block + 1);
+}
+
+struct pooled_block_releaser
+{
+    void operator()(detail::pooled_block* block) const {
+        release_pooled_block(block);
+    }
+};
+
+//! Owns a block from the pool and returns it when going out of scope
+using pooled_block_ptr =
+    std::unique_ptr<detail::pooled_block, pooled_block_releaser>;
+
 }
 
 #endif
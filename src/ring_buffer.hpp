@@ -0,0 +1,91 @@
+#ifndef _FIBERIO_SRC_RING_BUFFER_H_
+#define _FIBERIO_SRC_RING_BUFFER_H_
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace fiberio {
+
+//! Fixed-size byte FIFO that libuv can read straight into
+class ring_buffer
+{
+public:
+    ring_buffer()
+        : capacity_{0}, read_pos_{0}, size_{0} {}
+
+    explicit ring_buffer(std::size_t capacity)
+        : data_{ new char[capacity] }, capacity_{capacity}, read_pos_{0},
+          size_{0} {}
+
+    std::size_t capacity() const { return capacity_; }
+
+    std::size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    bool full() const { return size_ == capacity_; }
+
+    //! Start of the contiguous free space after the buffered data
+    char* write_ptr() {
+        return data_.get() + (read_pos_ + size_) % std::max<std::size_t>(
+            capacity_, 1);
+    }
+
+    //! Size of the contiguous free space after the buffered data
+    std::size_t write_space() const {
+        if (full()) return 0;
+        const std::size_t write_pos = (read_pos_ + size_) % capacity_;
+        if (write_pos >= read_pos_) {
+            return capacity_ - write_pos;
+        } else {
+            return read_pos_ - write_pos;
+        }
+    }
+
+    //! Marks len bytes at write_ptr() as buffered data
+    void commit(std::size_t len) {
+        size_ += len;
+    }
+
+    //! Start of the contiguous buffered data
+    const char* read_ptr() const { return data_.get() + read_pos_; }
+
+    //! Size of the contiguous buffered data
+    std::size_t read_space() const {
+        return std::min(size_, capacity_ - read_pos_);
+    }
+
+    //! Drops len bytes from the start of the buffered data
+    void consume(std::size_t len) {
+        size_ -= len;
+        if (size_ == 0) {
+            // Maximizes the contiguous space for the next write
+            read_pos_ = 0;
+        } else {
+            read_pos_ = (read_pos_ + len) % capacity_;
+        }
+    }
+
+    //! Copies up to len bytes into buf, consumes them and returns the count
+    std::size_t read(char* buf, std::size_t len) {
+        std::size_t total = 0;
+        while (total < len && !empty()) {
+            const std::size_t count = std::min(len - total, read_space());
+            std::memcpy(buf + total, read_ptr(), count);
+            consume(count);
+            total += count;
+        }
+        return total;
+    }
+
+private:
+    std::unique_ptr<char[]> data_;
+    std::size_t capacity_;
+    std::size_t read_pos_;
+    std::size_t size_;
+};
+
+}
+
+#endif
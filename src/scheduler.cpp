@@ -38,58 +38,18 @@ void suspend_timer_callback(uv_timer_t* handle)
 
 }
 
-scheduler::scheduler()
+loop_suspender::loop_suspender()
     : wake_up_{false}, suspended_{false}
 {
-    if (DEBUG_LOG) std::cout << "scheduler: creating scheduler\n";
     loop_ = get_uv_loop();
     timer_ = get_scheduler_timer();
     async_ = get_scheduler_async();
 }
 
-scheduler::~scheduler()
-{
-    if (DEBUG_LOG) std::cout << "scheduler: destroying scheduler\n";
-}
-
-void scheduler::awakened(fibers::context* fiber) noexcept
-{
-    if (DEBUG_LOG) std::cout << "scheduler::awakened(" <<
-        fiber->get_id() << ")\n";
-    queue_.push_back(fiber);
-}
-
-fibers::context* scheduler::pick_next() noexcept
-{
-    if (queue_.empty()) {
-        if (DEBUG_LOG) std::cout << "scheduler::pick_next() -> (no fiber)\n";
-        return nullptr;
-    } else {
-        fibers::context* fiber = queue_.front();
-        queue_.pop_front();
-        if (DEBUG_LOG) std::cout << "scheduler::pick_next() -> " <<
-            fiber->get_id() << "\n";
-        return fiber;
-    }
-}
-
-bool scheduler::has_ready_fibers() const noexcept
+void loop_suspender::suspend_until(
+    const std::chrono::steady_clock::time_point& abs_time,
+    const std::function<bool()>& has_work) noexcept
 {
-    if (DEBUG_LOG) {
-        if (queue_.empty()) {
-            std::cout << "scheduler::has_ready_fibers() -> false\n";
-        } else {
-            std::cout << "scheduler::has_ready_fibers() -> true\n";
-        }
-    }
-    return !queue_.empty();
-}
-
-void scheduler::suspend_until(
-    const std::chrono::steady_clock::time_point& abs_time) noexcept
-{
-    if (DEBUG_LOG) std::cout << "scheduler::suspend_until()\n";
-
     const bool wake_up_directly{ suspend_enter() };
     if (wake_up_directly) {
         if (DEBUG_LOG) std::cout << "not running event loop\n";
@@ -116,7 +76,7 @@ void scheduler::suspend_until(
     while (true) {
         if (DEBUG_LOG) std::cout << "running event loop\n";
         const int result = uv_run(loop_, UV_RUN_ONCE);
-        const bool ready_fibers = !queue_.empty();
+        const bool ready_fibers = has_work();
         const bool wake_up = should_wake_up();
 
         if (DEBUG_LOG) {
@@ -152,36 +112,35 @@ void scheduler::suspend_until(
     suspend_exit();
 }
 
-bool scheduler::suspend_enter()
+bool loop_suspender::suspend_enter()
 {
     std::lock_guard<std::mutex> lock{ mutex_ };
     suspended_ = true;
     return wake_up_;
 }
 
-bool scheduler::should_wake_up()
+bool loop_suspender::should_wake_up()
 {
     std::lock_guard<std::mutex> lock{ mutex_ };
     return wake_up_;
 }
 
-void scheduler::suspend_exit()
+void loop_suspender::suspend_exit()
 {
     std::lock_guard<std::mutex> lock{ mutex_ };
     wake_up_ = false;
     suspended_ = false;
 }
 
-bool scheduler::update_notify()
+bool loop_suspender::update_notify()
 {
     std::lock_guard<std::mutex> lock{ mutex_ };
     wake_up_ = true;
     return suspended_;
 }
 
-void scheduler::notify() noexcept
+void loop_suspender::notify() noexcept
 {
-    if (DEBUG_LOG) std::cout << "scheduler::notify()\n";
     bool suspended = update_notify();
     if (suspended) {
         if (DEBUG_LOG) std::cout << "scheduler uv_async_send()\n";
@@ -191,4 +150,60 @@ void scheduler::notify() noexcept
     }
 }
 
+scheduler::scheduler()
+{
+    if (DEBUG_LOG) std::cout << "scheduler: creating scheduler\n";
+}
+
+scheduler::~scheduler()
+{
+    if (DEBUG_LOG) std::cout << "scheduler: destroying scheduler\n";
+}
+
+void scheduler::awakened(fibers::context* fiber) noexcept
+{
+    if (DEBUG_LOG) std::cout << "scheduler::awakened(" <<
+        fiber->get_id() << ")\n";
+    queue_.push_back(fiber);
+}
+
+fibers::context* scheduler::pick_next() noexcept
+{
+    if (queue_.empty()) {
+        if (DEBUG_LOG) std::cout << "scheduler::pick_next() -> (no fiber)\n";
+        return nullptr;
+    } else {
+        fibers::context* fiber = queue_.front();
+        queue_.pop_front();
+        if (DEBUG_LOG) std::cout << "scheduler::pick_next() -> " <<
+            fiber->get_id() << "\n";
+        return fiber;
+    }
+}
+
+bool scheduler::has_ready_fibers() const noexcept
+{
+    if (DEBUG_LOG) {
+        if (queue_.empty()) {
+            std::cout << "scheduler::has_ready_fibers() -> false\n";
+        } else {
+            std::cout << "scheduler::has_ready_fibers() -> true\n";
+        }
+    }
+    return !queue_.empty();
+}
+
+void scheduler::suspend_until(
+    const std::chrono::steady_clock::time_point& abs_time) noexcept
+{
+    if (DEBUG_LOG) std::cout << "scheduler::suspend_until()\n";
+    suspender_.suspend_until(abs_time, [this]() { return !queue_.empty(); });
+}
+
+void scheduler::notify() noexcept
+{
+    if (DEBUG_LOG) std::cout << "scheduler::notify()\n";
+    suspender_.notify();
+}
+
 }
@@ -4,11 +4,50 @@
 #include <boost/fiber/all.hpp>
 #include <chrono>
 #include <deque>
+#include <functional>
 #include <mutex>
 #include <uv.h>
 
 namespace fiberio {
 
+/*! \brief Runs the thread's event loop while a scheduler has nothing to do
+ *
+ * This is shared by the schedulers. It runs the uv loop until has_work()
+ * returns true, the time runs out or notify() is called from any thread.
+ */
+class loop_suspender
+{
+public:
+    loop_suspender();
+
+    void suspend_until(
+        std::chrono::steady_clock::time_point const& abs_time,
+        const std::function<bool()>& has_work) noexcept;
+
+    void notify() noexcept;
+
+    uv_loop_t* get_loop() { return loop_; }
+
+    // Non-copyable and non-movable
+    loop_suspender(const loop_suspender&) = delete;
+    loop_suspender& operator=(const loop_suspender&) = delete;
+    loop_suspender(loop_suspender&&) = delete;
+    loop_suspender& operator=(loop_suspender&&) = delete;
+
+private:
+    bool should_wake_up();
+    bool suspend_enter();
+    void suspend_exit();
+    bool update_notify();
+
+    uv_loop_t* loop_;
+    uv_timer_t* timer_;
+    uv_async_t* async_;
+    bool wake_up_;
+    bool suspended_;
+    std::mutex mutex_;
+};
+
 class scheduler : public boost::fibers::algo::algorithm
 {
 public:
@@ -34,18 +73,8 @@ public:
     scheduler& operator=(scheduler&&) = delete;
 
 private:
-    bool should_wake_up();
-    bool suspend_enter();
-    void suspend_exit();
-    bool update_notify();
-
     std::deque<boost::fibers::context*> queue_;
-    uv_loop_t* loop_;
-    uv_timer_t* timer_;
-    uv_async_t* async_;
-    bool wake_up_;
-    bool suspended_;
-    std::mutex mutex_;
+    loop_suspender suspender_;
 };
 
 }
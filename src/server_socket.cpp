@@ -14,9 +14,10 @@ server_socket::~server_socket()
 {
 }
 
-void server_socket::bind(const std::string& host, uint16_t port)
+void server_socket::bind(const std::string& host, uint16_t port,
+    bool reuse_port)
 {
-    impl_->bind(host, port);
+    impl_->bind(host, port, reuse_port);
 }
 
 std::string server_socket::get_host()
@@ -34,11 +35,47 @@ void server_socket::listen(int backlog)
     impl_->listen(backlog);
 }
 
+void server_socket::set_listen_options(const listen_options& options)
+{
+    impl_->set_listen_options(options);
+}
+
+void server_socket::set_accepted_options(const tcp_options& options)
+{
+    impl_->set_accepted_options(options);
+}
+
 socket server_socket::accept()
 {
     return impl_->accept();
 }
 
+socket server_socket::accept(std::chrono::steady_clock::time_point deadline)
+{
+    return impl_->accept(deadline);
+}
+
+socket server_socket::accept(std::chrono::milliseconds timeout)
+{
+    return accept(std::chrono::steady_clock::now() + timeout);
+}
+
+socket server_socket::accept(std::error_code& ec)
+{
+    return impl_->accept(NO_DEADLINE, ec);
+}
+
+socket server_socket::accept(std::chrono::steady_clock::time_point deadline,
+    std::error_code& ec)
+{
+    return impl_->accept(deadline, ec);
+}
+
+std::vector<socket> server_socket::accept_many(std::size_t max)
+{
+    return impl_->accept_many(max);
+}
+
 void server_socket::close()
 {
     impl_->close();
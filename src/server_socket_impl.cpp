@@ -3,12 +3,16 @@
 #include "addrinfo.hpp"
 #include "loop.hpp"
 #include "utils.hpp"
+#include "work_stealing_scheduler.hpp"
 #include <iostream>
 #include <string>
 #include <algorithm>
 #include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 
 namespace fibers = boost::fibers;
 
@@ -25,6 +29,15 @@ void connection_callback(uv_stream_t* server, int status)
     socket->on_connection(status);
 }
 
+int apply_to_listener(uv_os_sock_t fd, const listen_options& listen,
+                      const tcp_options& accepted)
+{
+    int status = apply_listen_options(fd, listen);
+    if (status < 0) return status;
+    // Setting all of them also checks that the rest can be set on connections
+    return apply_tcp_options(fd, accepted, tcp_option_set::all);
+}
+
 std::string addr_to_string(int af, const void* src)
 {
     assert(af == AF_INET || af == AF_INET6);
@@ -34,10 +47,25 @@ std::string addr_to_string(int af, const void* src)
     return std::string(buf);
 }
 
+void delete_tcp_handle(uv_handle_t* handle)
+{
+    delete reinterpret_cast<uv_tcp_t*>(handle);
+}
+
+void throw_if_accept_failed(const std::error_code& ec)
+{
+    // Accept loops stop on runtime_error and carry on after io_error
+    if (ec.value() == UV_ECANCELED) {
+        throw std::runtime_error("connection closed");
+    }
+    throw_if_error(ec);
+}
+
 }
 
 server_socket_impl::server_socket_impl()
-    : loop_{get_uv_loop()}, pending_connections_{0}, closed_{false}
+    : loop_{get_uv_loop()}, pending_connections_{0}, accept_error_{0},
+      closed_{false}, tune_each_accepted_{false}, drain_paused_{false}
 {
     if (DEBUG_LOG) std::cout << "creating server_socket_impl\n";
     uv_tcp_init(loop_, &tcp_);
@@ -55,16 +83,49 @@ server_socket_impl::~server_socket_impl() {
     }
 }
 
-void server_socket_impl::bind(const std::string& host, uint16_t port) {
-    if (DEBUG_LOG) std::cout << "calling getaddrinfo for " << host <<
-        ":" << port << "\n";
+void server_socket_impl::bind(const std::string& host, uint16_t port,
+    bool reuse_port) {
+    bind_this_fiber_to_loop(loop_);
     host_ = host;
     port_ = port;
-    auto addr = getaddrinfo(host, port);
+    struct sockaddr_storage numeric_addr;
+    addrinfo_ptr resolved{ nullptr, uv_freeaddrinfo };
+    const struct sockaddr* addr = (struct sockaddr*) &numeric_addr;
+    if (!parse_ip_address(host, port, numeric_addr)) {
+        if (DEBUG_LOG) std::cout << "calling getaddrinfo for " << host <<
+            ":" << port << "\n";
+        resolved = getaddrinfo(host, port);
+        addr = resolved->ai_addr;
+    }
+    if (reuse_port) {
+        // libuv can't set SO_REUSEPORT itself, so the socket is created here
+        open_reuse_port_socket(addr->sa_family);
+    }
     if (DEBUG_LOG) std::cout << "binding to address\n";
-    int status = uv_tcp_bind(&tcp_, addr->ai_addr, 0);
+    int status = uv_tcp_bind(&tcp_, addr, 0);
     check_uv_status(status);
     update_address();
+    throw_if_error(make_io_error_code(
+        apply_options(listen_options_, accepted_options_)));
+}
+
+void server_socket_impl::open_reuse_port_socket(int family)
+{
+    if (DEBUG_LOG) std::cout << "creating socket with SO_REUSEPORT\n";
+    int fd = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) check_uv_status(uv_translate_sys_error(errno));
+    int enable = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+            sizeof(enable)) < 0) {
+        int status = uv_translate_sys_error(errno);
+        ::close(fd);
+        check_uv_status(status);
+    }
+    int status = uv_tcp_open(&tcp_, fd);
+    if (status < 0) {
+        ::close(fd);
+    }
+    check_uv_status(status);
 }
 
 void server_socket_impl::update_address()
@@ -100,16 +161,65 @@ uint16_t server_socket_impl::get_port()
 }
 
 void server_socket_impl::listen(int backlog) {
+    bind_this_fiber_to_loop(loop_);
     if (DEBUG_LOG) std::cout << "listening\n";
     int status = uv_listen((uv_stream_t*) &tcp_, backlog, connection_callback);
     check_uv_status(status);
 }
 
+void server_socket_impl::set_listen_options(const listen_options& options) {
+    bind_this_fiber_to_loop(loop_);
+    throw_if_error(make_io_error_code(
+        apply_options(options, accepted_options_)));
+    listen_options_ = options;
+}
+
+void server_socket_impl::set_accepted_options(const tcp_options& options) {
+    bind_this_fiber_to_loop(loop_);
+    throw_if_error(make_io_error_code(
+        apply_options(listen_options_, options)));
+    accepted_options_ = options;
+    tune_each_accepted_ =
+        has_tcp_options(options, tcp_option_set::not_inherited);
+}
+
+int server_socket_impl::apply_options(const listen_options& listen,
+                                      const tcp_options& accepted) {
+    uv_os_fd_t fd;
+    const bool bound = uv_fileno((uv_handle_t*) &tcp_, &fd) == 0;
+    int family = AF_INET;
+    if (bound) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (::getsockname(fd, (struct sockaddr*) &addr, &len) != 0) {
+            return uv_translate_sys_error(errno);
+        }
+        family = addr.ss_family;
+    }
+    // Options are tried on a scratch socket first, so that a rejected set
+    // leaves neither the listener nor the stored options half changed
+    int scratch = ::socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (scratch < 0) return uv_translate_sys_error(errno);
+    int status = apply_to_listener(scratch, listen, accepted);
+    ::close(scratch);
+    // The socket is created by bind(), which calls this again
+    if (status < 0 || !bound) return status;
+    return apply_to_listener(fd, listen, accepted);
+}
+
 void server_socket_impl::on_connection(int status) {
     try {
-        pending_connections_++;
-        if (DEBUG_LOG) std::cout << "increased pending_connections_ to " <<
-            pending_connections_ << "\n";
+        if (status < 0) {
+            if (DEBUG_LOG) std::cout << "connection error: " <<
+                uv_err_name(status) << "\n";
+            accept_error_ = status;
+        } else {
+            // libuv got a descriptor for it, so there are some to spare again
+            drain_paused_ = false;
+            pending_connections_++;
+            if (DEBUG_LOG) std::cout << "increased pending_connections_ to " <<
+                pending_connections_ << "\n";
+        }
         cond_.notify_all();
     } catch (std::exception& e) {
         if (DEBUG_LOG) std::cout << "on_connection error: " <<
@@ -118,24 +228,175 @@ void server_socket_impl::on_connection(int status) {
     }
 }
 
-socket server_socket_impl::accept() {
-    // Wait until there is at least one connection to accept
+int server_socket_impl::wait_for_connection(const deadline& until) {
     if (DEBUG_LOG) std::cout << "waiting for connection to accept\n";
     dummy_lock lock;
-    while (pending_connections_ == 0 && !closed_) {
-        cond_.wait(lock);
+    while (pending_connections_ == 0 && accept_error_ == 0 && !closed_) {
+        if (!wait_until(cond_, lock, until) && pending_connections_ == 0 &&
+                accept_error_ == 0 && !closed_) {
+            return UV_ETIMEDOUT;
+        }
+    }
+    if (closed_) return UV_ECANCELED;
+    if (pending_connections_ == 0) {
+        // Report the error once, so that accepting can continue after it
+        int status = accept_error_;
+        accept_error_ = 0;
+        return status;
     }
-    if (closed_) throw std::runtime_error("connection closed");
-    // Accept connection
+    return 0;
+}
+
+socket_impl_ptr server_socket_impl::accept_pending(std::error_code& ec) {
     if (DEBUG_LOG) std::cout << "going to accept pending connection\n";
     pending_connections_--;
-    auto new_socket_impl = std::make_shared<socket_impl>();
-    new_socket_impl->do_accept((uv_stream_t*) &tcp_);
-    return socket{ std::move(new_socket_impl) };
+    auto new_socket_impl = make_socket_impl();
+    ec = make_io_error_code(
+        new_socket_impl->do_accept((uv_stream_t*) &tcp_));
+    if (!ec && tune_each_accepted_) {
+        // The options were fine for the listening socket, so a failure here
+        // isn't worth losing the connection over
+        new_socket_impl->apply_options(accepted_options_,
+            tcp_option_set::not_inherited);
+    }
+    return new_socket_impl;
+}
+
+socket_impl_ptr server_socket_impl::accept_pending() {
+    std::error_code ec;
+    auto new_socket_impl = accept_pending(ec);
+    throw_if_error(ec);
+    return new_socket_impl;
+}
+
+void server_socket_impl::drain_backlog(std::vector<uv_os_sock_t>& fds,
+    std::size_t max) {
+    // libuv only hands over one connection per loop iteration, so the rest of
+    // the backlog is taken directly from the listening socket
+    if (drain_paused_) return;
+    uv_os_fd_t fd;
+    // Only fails if the server isn't listening, which is reported elsewhere
+    if (uv_fileno((uv_handle_t*) &tcp_, &fd) != 0) return;
+    while (fds.size() < max) {
+#ifdef __linux__
+        int client = ::accept4(fd, nullptr, nullptr,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int client = ::accept(fd, nullptr, nullptr);
+#endif
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                // Leave the backlog to libuv, which sheds connections it has
+                // no descriptors for instead of leaving them to spin on
+                if (DEBUG_LOG) std::cout << "out of descriptors\n";
+                drain_paused_ = true;
+            }
+            // Anything but EAGAIN will be reported by libuv on the next call
+            break;
+        }
+        if (tune_each_accepted_) {
+            apply_tcp_options(client, accepted_options_,
+                tcp_option_set::not_inherited);
+        }
+        fds.push_back(client);
+    }
+}
+
+socket server_socket_impl::accept(const deadline& until) {
+    std::error_code ec;
+    socket connection = accept(until, ec);
+    throw_if_accept_failed(ec);
+    return connection;
+}
+
+socket server_socket_impl::accept(const deadline& until,
+    std::error_code& ec) {
+    bind_this_fiber_to_loop(loop_);
+    ec = make_io_error_code(wait_for_connection(until));
+    if (ec) return socket{};
+    return socket{ accept_pending(ec) };
+}
+
+std::vector<socket> server_socket_impl::accept_many(std::size_t max) {
+    bind_this_fiber_to_loop(loop_);
+    std::vector<socket> sockets;
+    if (max == 0) return sockets;
+    throw_if_accept_failed(make_io_error_code(wait_for_connection()));
+    while (pending_connections_ > 0 && sockets.size() < max) {
+        sockets.push_back(socket{ accept_pending() });
+    }
+    std::vector<uv_os_sock_t> fds;
+    drain_backlog(fds, max - sockets.size());
+    for (std::size_t i = 0; i < fds.size(); i++) {
+        auto new_socket_impl = make_socket_impl();
+        try {
+            new_socket_impl->do_open(fds[i]);
+        } catch (...) {
+            // do_open() closed this one already, but not the rest
+            for (std::size_t j = i + 1; j < fds.size(); j++) ::close(fds[j]);
+            throw;
+        }
+        sockets.push_back(socket{ std::move(new_socket_impl) });
+    }
+    if (DEBUG_LOG) std::cout << "accepted " << sockets.size() <<
+        " connections\n";
+    return sockets;
+}
+
+std::vector<uv_os_sock_t> server_socket_impl::accept_fds(std::size_t max,
+    std::error_code& ec) {
+    bind_this_fiber_to_loop(loop_);
+    ec.clear();
+    std::vector<uv_os_sock_t> fds;
+    if (max == 0) return fds;
+    // Connections that are already waiting are cheapest to take directly, so
+    // libuv's way is only needed after waiting
+    drain_backlog(fds, max);
+    if (fds.empty()) {
+        ec = make_io_error_code(wait_for_connection());
+        if (ec) return fds;
+    }
+    while (pending_connections_ > 0 && fds.size() < max) {
+        uv_os_sock_t fd;
+        ec = make_io_error_code(take_pending_fd(fd));
+        if (ec) return fds;
+        fds.push_back(fd);
+    }
+    drain_backlog(fds, max);
+    return fds;
+}
+
+int server_socket_impl::take_pending_fd(uv_os_sock_t& fd) {
+    if (DEBUG_LOG) std::cout << "taking descriptor of pending connection\n";
+    pending_connections_--;
+    // libuv only hands over its connection in a handle, and can't let go of a
+    // handle's descriptor without closing it. The handle keeps the original
+    // and is closed in the background, so this never waits.
+    uv_tcp_t* handle = new uv_tcp_t;
+    int status = uv_tcp_init(loop_, handle);
+    if (status < 0) {
+        delete handle;
+        return status;
+    }
+    status = uv_accept((uv_stream_t*) &tcp_, (uv_stream_t*) handle);
+    uv_os_fd_t own_fd;
+    if (status == 0) status = uv_fileno((uv_handle_t*) handle, &own_fd);
+    if (status == 0) {
+        fd = ::fcntl(own_fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0) status = uv_translate_sys_error(errno);
+    }
+    uv_close((uv_handle_t*) handle, delete_tcp_handle);
+    if (status == 0 && tune_each_accepted_) {
+        apply_tcp_options(fd, accepted_options_,
+            tcp_option_set::not_inherited);
+    }
+    return status;
 }
 
 void server_socket_impl::close() {
     if (!closed_) {
+        bind_this_fiber_to_loop(loop_);
         if (DEBUG_LOG) std::cout << "closing server_socket_impl\n";
         closed_ = true;
         close_handle(&tcp_);
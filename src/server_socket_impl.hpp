@@ -1,9 +1,13 @@
 #ifndef _FIBERIO_SRC_SERVER_SOCKET_IMPL_H_
 #define _FIBERIO_SRC_SERVER_SOCKET_IMPL_H_
 
+#include "socket_impl.hpp"
+#include "tcp_options_impl.hpp"
+#include "utils.hpp"
 #include <fiberio/socket.hpp>
 #include <boost/fiber/all.hpp>
 #include <memory>
+#include <system_error>
 #include <vector>
 #include <thread>
 #include <cstdint>
@@ -23,7 +27,7 @@ public:
     server_socket_impl& operator=(const server_socket_impl&) = delete;
     server_socket_impl& operator=(server_socket_impl&&) = delete;
 
-    void bind(const std::string& host, uint16_t port);
+    void bind(const std::string& host, uint16_t port, bool reuse_port);
 
     void update_address();
 
@@ -33,20 +37,65 @@ public:
 
     void listen(int backlog);
 
+    void set_listen_options(const listen_options& options);
+
+    void set_accepted_options(const tcp_options& options);
+
     void on_connection(int status);
 
-    socket accept();
+    socket accept(const deadline& until = NO_DEADLINE);
+
+    socket accept(const deadline& until, std::error_code& ec);
+
+    std::vector<socket> accept_many(std::size_t max);
+
+    /*! \brief Like accept_many(), but returns descriptors no loop owns yet
+     *
+     * Errors are reported in ec, together with the descriptors accepted before
+     * them. UV_ECANCELED means that the server was closed.
+     */
+    std::vector<uv_os_sock_t> accept_fds(std::size_t max,
+        std::error_code& ec);
 
     void close();
 
 private:
+    void open_reuse_port_socket(int family);
+
+    //! Returns the libuv status, UV_ECANCELED if the server was closed
+    int wait_for_connection(const deadline& until = NO_DEADLINE);
+
+    socket_impl_ptr accept_pending(std::error_code& ec);
+
+    socket_impl_ptr accept_pending();
+
+    void drain_backlog(std::vector<uv_os_sock_t>& fds, std::size_t max);
+
+    //! Takes the descriptor of a connection libuv accepted; returns the status
+    int take_pending_fd(uv_os_sock_t& fd);
+
+    /*! \brief Checks the options and sets them on the listening socket
+     *
+     * Nothing is changed if the system rejects any of them. Returns the
+     * status.
+     */
+    int apply_options(const listen_options& listen,
+                      const tcp_options& accepted);
+
     uv_loop_t* loop_;
     uv_tcp_t tcp_;
     boost::fibers::condition_variable_any cond_;
     int pending_connections_;
+    int accept_error_;
     bool closed_;
     std::string host_;
     uint16_t port_;
+    listen_options listen_options_;
+    tcp_options accepted_options_;
+    //! True if some accepted_options_ have to be set on each connection
+    bool tune_each_accepted_;
+    //! Set when out of descriptors, until libuv accepts a connection again
+    bool drain_paused_;
 };
 
 
@@ -1,10 +1,47 @@
 #include <fiberio/socket.hpp>
 #include "socket_impl.hpp"
+#include "loop.hpp"
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
 
 namespace fiberio {
 
+detached_socket::detached_socket()
+    : fd_{-1}, streaming_{false}, stream_buf_size_{0}
+{
+}
+
+detached_socket::detached_socket(detached_socket&& other)
+    : fd_{ other.fd_ }, streaming_{ other.streaming_ },
+      stream_buf_size_{ other.stream_buf_size_ },
+      buffered_{ std::move(other.buffered_) }
+{
+    other.fd_ = -1;
+}
+
+detached_socket::~detached_socket()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+detached_socket& detached_socket::operator=(detached_socket&& other)
+{
+    if (this != &other) {
+        if (fd_ >= 0) ::close(fd_);
+        fd_ = other.fd_;
+        streaming_ = other.streaming_;
+        stream_buf_size_ = other.stream_buf_size_;
+        buffered_ = std::move(other.buffered_);
+        other.fd_ = -1;
+    }
+    return *this;
+}
+
 socket::socket()
-    : impl_{ std::make_shared<socket_impl>() }
+    : impl_{ make_socket_impl() }
 {
 }
 
@@ -12,11 +49,17 @@ socket::socket(const socket&) = default;
 
 socket::socket(socket&&) = default;
 
-socket::socket(std::shared_ptr<socket_impl>&& impl)
+socket::socket(socket_impl_ptr&& impl)
     : impl_{ std::move(impl) }
 {
 }
 
+socket::socket(detached_socket&& detached)
+    : impl_{ make_socket_impl() }
+{
+    impl_->attach(std::move(detached));
+}
+
 socket::~socket()
 {
 }
@@ -30,50 +73,136 @@ void socket::connect(const std::string& host, uint16_t port)
     impl_->connect(host, port);
 }
 
+void socket::connect(const std::string& host, uint16_t port,
+    std::chrono::steady_clock::time_point deadline)
+{
+    impl_->connect(host, port, deadline);
+}
+
+void socket::connect(const std::string& host, uint16_t port,
+    std::chrono::milliseconds timeout)
+{
+    connect(host, port, std::chrono::steady_clock::now() + timeout);
+}
+
+void socket::connect(const std::string& host, uint16_t port,
+    std::error_code& ec)
+{
+    impl_->connect(host, port, NO_DEADLINE, ec);
+}
+
+void socket::connect(const std::string& host, uint16_t port,
+    std::chrono::steady_clock::time_point deadline, std::error_code& ec)
+{
+    impl_->connect(host, port, deadline, ec);
+}
+
 std::size_t socket::read(char* buf, std::size_t size)
 {
     return impl_->read(buf, size);
 }
 
+std::size_t socket::read(char* buf, std::size_t size,
+    std::chrono::steady_clock::time_point deadline)
+{
+    return impl_->read(buf, size, deadline);
+}
+
+std::size_t socket::read(char* buf, std::size_t size,
+    std::chrono::milliseconds timeout)
+{
+    return read(buf, size, std::chrono::steady_clock::now() + timeout);
+}
+
+std::size_t socket::read(char* buf, std::size_t size, std::error_code& ec)
+{
+    return impl_->read(buf, size, NO_DEADLINE, ec);
+}
+
+std::size_t socket::read(char* buf, std::size_t size,
+    std::chrono::steady_clock::time_point deadline, std::error_code& ec)
+{
+    return impl_->read(buf, size, deadline, ec);
+}
+
 void socket::read_exactly(char* buf, std::size_t size)
+{
+    read_exactly(buf, size, std::chrono::steady_clock::time_point::max());
+}
+
+void socket::read_exactly(char* buf, std::size_t size,
+    std::chrono::steady_clock::time_point deadline)
 {
     std::size_t bytes_left = size;
     char* current_buf = buf;
     while (bytes_left > 0) {
-        std::size_t bytes_read = read(current_buf, bytes_left);
+        std::size_t bytes_read = read(current_buf, bytes_left, deadline);
         bytes_left -= bytes_read;
         current_buf += bytes_read;
     }
 }
 
-std::string socket::read_string(std::size_t count, bool shrink_to_fit)
+void socket::read_exactly(char* buf, std::size_t size,
+    std::chrono::milliseconds timeout)
+{
+    read_exactly(buf, size, std::chrono::steady_clock::now() + timeout);
+}
+
+std::size_t socket::read(const mutable_buffer* bufs, std::size_t count)
+{
+    return impl_->read(bufs, count);
+}
+
+void socket::read_exactly(const mutable_buffer* bufs, std::size_t count)
 {
-#if __cplusplus >= 201703L
-        std::string buf(count, '\0');
-        std::size_t bytes_read = read(buf.data(), buf.size());
-        if (bytes_read < count) {
-            buf.erase(bytes_read);
-            if (shrink_to_fit) buf.shrink_to_fit();
+    std::vector<mutable_buffer> bufs_left(bufs, bufs + count);
+    auto current = bufs_left.begin();
+    while (true) {
+        while (current != bufs_left.end() && current->size == 0) ++current;
+        if (current == bufs_left.end()) break;
+        std::size_t bytes_read = read(&*current, bufs_left.end() - current);
+        while (bytes_read > 0) {
+            std::size_t used = std::min(current->size, bytes_read);
+            current->data += used;
+            current->size -= used;
+            bytes_read -= used;
+            if (current->size == 0) ++current;
         }
-        return buf;
-#else
-        std::vector<char> buf(count, '\0');
-        std::size_t bytes_read = read(buf.data(), buf.size());
-        return std::string(buf.data(), bytes_read);
-#endif
+    }
+}
+
+std::string socket::read_string(std::size_t count, bool shrink_to_fit)
+{
+    // Reading into a pooled buffer avoids allocating and zeroing count bytes
+    pooled_block_ptr block{ acquire_pooled_block(count) };
+    char* data = get_block_data(block.get());
+    std::size_t bytes_read = read(data, count);
+    std::string result;
+    if (!shrink_to_fit) result.reserve(count);
+    result.assign(data, bytes_read);
+    return result;
 }
 
 std::string socket::read_string_exactly(std::size_t count)
 {
-#if __cplusplus >= 201703L
-        std::string buf(count, '\0');
-        read_exactly(buf.data(), buf.size());
-        return buf;
-#else
-        std::vector<char> buf(count, '\0');
-        read_exactly(buf.data(), buf.size());
-        return std::string(buf.data(), buf.size());
-#endif
+    pooled_block_ptr block{ acquire_pooled_block(count) };
+    char* data = get_block_data(block.get());
+    read_exactly(data, count);
+    return std::string(data, count);
+}
+
+buffer_slice socket::read_slice(std::size_t max_size)
+{
+    max_size = std::min(max_size, MAX_SLICE_SIZE);
+    detail::pooled_block* block = acquire_pooled_block(max_size);
+    char* data = get_block_data(block);
+    // The slice owns the block from here on, also if read() throws
+    buffer_slice slice{ block, data, 0 };
+    slice.size_ = read(data, max_size);
+    if (slice.empty()) {
+        return buffer_slice{};
+    }
+    return slice;
 }
 
 void socket::write(const std::string& data) {
@@ -85,11 +214,107 @@ void socket::write(const char* data, std::size_t len)
     impl_->write(data, len);
 }
 
+void socket::write(const char* data, std::size_t len,
+    std::chrono::steady_clock::time_point deadline)
+{
+    impl_->write(data, len, deadline);
+}
+
+void socket::write(const char* data, std::size_t len,
+    std::chrono::milliseconds timeout)
+{
+    write(data, len, std::chrono::steady_clock::now() + timeout);
+}
+
+void socket::write(const char* data, std::size_t len, std::error_code& ec)
+{
+    write(data, len, NO_DEADLINE, ec);
+}
+
+void socket::write(const char* data, std::size_t len,
+    std::chrono::steady_clock::time_point deadline, std::error_code& ec)
+{
+    const const_buffer buf{ data, len };
+    impl_->write(&buf, 1, deadline, ec);
+}
+
+std::uint64_t socket::send_file(int file_fd, std::uint64_t offset,
+    std::uint64_t length)
+{
+    return impl_->send_file(file_fd, offset, length);
+}
+
+std::uint64_t socket::send_file(const std::string& path, std::uint64_t offset,
+    std::uint64_t length)
+{
+    return impl_->send_file(path, offset, length);
+}
+
+void socket::write_async(const char* data, std::size_t len)
+{
+    impl_->write_async(data, len);
+}
+
+void socket::write_async(std::string&& data)
+{
+    impl_->write_async(std::move(data));
+}
+
+void socket::flush()
+{
+    impl_->flush();
+}
+
+void socket::set_write_queue_limit(std::size_t bytes)
+{
+    impl_->set_write_queue_limit(bytes);
+}
+
+void socket::set_streaming(bool enabled, std::size_t buffer_size)
+{
+    impl_->set_streaming(enabled, buffer_size);
+}
+
+void socket::write(const const_buffer* bufs, std::size_t count)
+{
+    impl_->write(bufs, count);
+}
+
+void socket::write(std::initializer_list<const_buffer> bufs)
+{
+    write(bufs.begin(), bufs.size());
+}
+
+void socket::set_options(const tcp_options& options)
+{
+    impl_->set_options(options);
+}
+
+void socket::set_idle_timeout(std::chrono::milliseconds timeout)
+{
+    impl_->set_idle_timeout(timeout);
+}
+
+detached_socket socket::detach()
+{
+    return impl_->detach();
+}
+
 void socket::close()
 {
     impl_->close();
 }
 
+void socket::close(close_mode mode)
+{
+    impl_->close(mode);
+}
+
+void socket::set_close_mode_on_destroy(close_mode mode)
+{
+    impl_->set_close_mode_on_destroy(mode);
+}
+
 bool socket::is_open()
 {
     return impl_->is_open();
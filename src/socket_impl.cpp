@@ -1,11 +1,27 @@
 #include "socket_impl.hpp"
 #include <fiberio/exceptions.hpp>
 #include "addrinfo.hpp"
+#include "connection_race.hpp"
 #include "loop.hpp"
 #include "utils.hpp"
+#include "work_stealing_scheduler.hpp"
 #include <exception>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 namespace fibers = boost::fibers;
+namespace this_fiber = boost::this_fiber;
 
 namespace fiberio {
 
@@ -13,33 +29,102 @@ namespace {
 
 const bool DEBUG_LOG = false;
 
-const int64_t ERROR_EOF = -1;
-const int64_t ERROR_READ_FAILED = -2;
+// Reads that don't have to wait yield to other fibers this often
+const unsigned FAST_READS_BEFORE_YIELD = 16;
 
-void connection_callback(uv_connect_t* req, int status)
+// Vectored writes with up to this many buffers don't allocate
+const std::size_t SMALL_BUF_COUNT = 8;
+
+const std::size_t MAX_IOV_COUNT = 64;
+
+// Bigger sendfile() calls only return once the socket buffer is full anyway
+const std::size_t MAX_SENDFILE_CHUNK = 1024 * 1024;
+
+// Files that sendfile() can't handle are copied through blocks of this size
+const std::size_t FILE_COPY_BLOCK_SIZE = 64 * 1024;
+
+//! A write that continues in the background and owns its data
+struct queued_write
+{
+    uv_write_t req;
+    socket_impl* socket;
+    std::string data;
+    std::size_t offset;
+};
+
+void async_write_callback(uv_write_t* req, int status)
 {
     void* data = uv_req_get_data((uv_req_t*) req);
-    fibers::promise<void>* promise = static_cast<fibers::promise<void>*>(data);
-    try {
-        check_uv_status(status);
-        promise->set_value();
-    } catch (std::exception& e) {
-        promise->set_exception(std::current_exception());
-    }
+    std::unique_ptr<queued_write> write{ static_cast<queued_write*>(data) };
+    write->socket->on_async_write_finished(
+        write->data.size() - write->offset, status);
 }
 
-void write_callback(uv_write_t* req, int status)
+void on_writable(uv_poll_t* handle, int status, int)
 {
-    void* data = uv_req_get_data((uv_req_t*) req);
-    fibers::promise<void>* promise = static_cast<fibers::promise<void>*>(data);
-    try {
-        check_uv_status(status);
-        promise->set_value();
-    } catch (std::exception& e) {
-        promise->set_exception(std::current_exception());
-    }
+    uv_poll_stop(handle);
+    void* data = uv_handle_get_data((uv_handle_t*) handle);
+    static_cast<completion_slot*>(data)->complete(status);
 }
 
+/*! \brief Waits for a socket to have room for more data
+ *
+ * libuv already watches the socket's descriptor, so this polls a duplicate of
+ * it, which epoll treats as a separate entry. The duplicate is only made once
+ * the first wait() is needed.
+ */
+class writable_watcher
+{
+public:
+    writable_watcher(uv_loop_t* loop, uv_os_fd_t fd)
+        : loop_{loop}, fd_{fd}, copy_{-1}
+    {}
+
+    writable_watcher(const writable_watcher&) = delete;
+    writable_watcher& operator=(const writable_watcher&) = delete;
+
+    ~writable_watcher() {
+        if (copy_ >= 0) {
+            close_handle((uv_handle_t*) &poll_);
+            ::close(copy_);
+        }
+    }
+
+    //! Returns the libuv status
+    int wait() {
+        if (copy_ < 0) {
+            int copy = ::fcntl(fd_, F_DUPFD_CLOEXEC, 0);
+            if (copy < 0) return uv_translate_sys_error(errno);
+            int status = uv_poll_init_socket(loop_, &poll_, copy);
+            if (status < 0) {
+                ::close(copy);
+                return status;
+            }
+            copy_ = copy;
+        }
+        if (DEBUG_LOG) std::cout << "waiting for socket to be writable\n";
+        completion_slot slot;
+        uv_handle_set_data((uv_handle_t*) &poll_, &slot);
+        int status = uv_poll_start(&poll_, UV_WRITABLE, on_writable);
+        if (status < 0) return status;
+        return slot.wait();
+    }
+
+private:
+    uv_loop_t* loop_;
+    uv_os_fd_t fd_;
+    uv_os_fd_t copy_;
+    uv_poll_t poll_;
+};
+
+//! Closes a file descriptor when going out of scope
+struct file_closer
+{
+    int fd;
+
+    ~file_closer() { ::close(fd); }
+};
+
 void alloc_callback(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
 {
     void* data = uv_handle_get_data((uv_handle_t*) handle);
@@ -59,122 +144,542 @@ void read_callback(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
     if (DEBUG_LOG) std::cout << "stop reading\n";
     uv_read_stop(stream);
 
-    if (nread >= 0) {
-        if (DEBUG_LOG) std::cout << "read " << nread << " bytes\n";
-        socket->on_read_finished(nread);
-    } else if (nread == UV_EOF) {
-        socket->on_read_finished(ERROR_EOF);
-    } else {
-        if (DEBUG_LOG) std::cout << "read error\n";
-        socket->on_read_finished(ERROR_READ_FAILED);
-    }
+    if (DEBUG_LOG) std::cout << "read finished with " << nread << "\n";
+    // Errors, including UV_EOF, are passed on as they are
+    socket->on_read_finished(nread);
 }
 
-void shutdown_callback(uv_shutdown_t* req, int status)
+void stream_alloc_callback(uv_handle_t* handle, size_t suggested_size,
+    uv_buf_t* buf)
 {
-    void* data = uv_req_get_data((uv_req_t*) req);
-    fibers::promise<void>* promise = static_cast<fibers::promise<void>*>(data);
-    try {
-        check_uv_status(status);
-        promise->set_value();
-    } catch (std::exception& e) {
-        promise->set_exception(std::current_exception());
-    }
+    void* data = uv_handle_get_data(handle);
+    socket_impl* socket = static_cast<socket_impl*>(data);
+    socket->get_stream_space(buf);
+}
+
+void stream_read_callback(uv_stream_t* stream, ssize_t nread,
+    const uv_buf_t* buf)
+{
+    void* data = uv_handle_get_data((uv_handle_t*) stream);
+    socket_impl* socket = static_cast<socket_impl*>(data);
+    socket->on_stream_read(nread);
+}
+
+void idle_timeout_callback(timer_wheel_entry* entry)
+{
+    static_cast<socket_impl*>(entry->data)->on_idle_timeout();
+}
+
+void background_close_callback(uv_handle_t* handle)
+{
+    if (DEBUG_LOG) std::cout << "closed handle in the background\n";
+    void* data = uv_handle_get_data(handle);
+    intrusive_ptr_release(static_cast<socket_impl*>(data));
+}
+
+void background_shutdown_callback(uv_shutdown_t* req, int status)
+{
+    if (DEBUG_LOG) std::cout << "background shutdown finished with " <<
+        status << "\n";
+    uv_close((uv_handle_t*) req->handle, background_close_callback);
 }
 
 }
 
 socket_impl::socket_impl()
-    : loop_{get_uv_loop()}, closed_{false}, reading_{false}, buf_{0}, len_{0}
+    : refs_{0}, loop_{get_uv_loop()}, closed_{false}, reading_{false},
+      streaming_{false}, stream_reading_{false}, stream_eof_{false},
+      fast_reads_{0}, stream_error_{0}, buf_{0}, len_{0},
+      write_queue_limit_{socket::DEFAULT_WRITE_QUEUE_LIMIT}, queued_bytes_{0},
+      pending_offset_{0}, writing_async_{false}, write_error_{0},
+      wheel_{nullptr}, close_mode_on_destroy_{socket::close_mode::wait}
 {
     if (DEBUG_LOG) std::cout << "creating socket_impl\n";
     uv_tcp_init(loop_, &tcp_);
     uv_handle_set_data((uv_handle_t*) &tcp_, this);
+    idle_entry_.callback = idle_timeout_callback;
+    idle_entry_.data = this;
 }
 
 socket_impl::~socket_impl() {
     if (!closed_) {
         if (DEBUG_LOG) std::cout <<
             "closing socket_impl from destructor\n";
-        close();
+        // A destructor has nobody to report the shutdown's status to
+        close_with_status();
     } else {
         if (DEBUG_LOG) std::cout <<
             "destroying closed socket_impl\n";
     }
 }
 
-void socket_impl::do_accept(uv_stream_t* server)
+void* socket_impl::operator new(std::size_t size)
+{
+    return allocate_socket_storage(size);
+}
+
+void socket_impl::operator delete(void* storage, std::size_t size) noexcept
+{
+    free_socket_storage(storage, size);
+}
+
+void intrusive_ptr_add_ref(socket_impl* impl)
+{
+    impl->refs_++;
+}
+
+void intrusive_ptr_release(socket_impl* impl)
+{
+    if (--impl->refs_ == 0) {
+        if (!impl->closed_ &&
+                impl->close_mode_on_destroy_ != socket::close_mode::wait) {
+            // The loop deletes it once the handle is closed
+            impl->close(impl->close_mode_on_destroy_);
+        } else {
+            delete impl;
+        }
+    }
+}
+
+int socket_impl::do_accept(uv_stream_t* server)
 {
     if (DEBUG_LOG) std::cout << "accepting connection\n";
-    int status = uv_accept(server, (uv_stream_t*) &tcp_);
+    return uv_accept(server, (uv_stream_t*) &tcp_);
+}
+
+void socket_impl::do_open(uv_os_sock_t fd)
+{
+    if (DEBUG_LOG) std::cout << "opening accepted connection\n";
+    int status = uv_tcp_open(&tcp_, fd);
+    if (status < 0) {
+        ::close(fd);
+    }
     check_uv_status(status);
 }
 
-void socket_impl::connect(const std::string& host, uint16_t port)
+uv_os_sock_t socket_impl::release_fd()
 {
     if (closed_) throw socket_closed_error{};
-    if (DEBUG_LOG) std::cout << "calling getaddrinfo for " << host << ":" <<
-        port << "\n";
+    bind_this_fiber_to_loop(loop_);
+    if (DEBUG_LOG) std::cout << "releasing descriptor of socket_impl\n";
+    uv_os_fd_t fd;
+    throw_if_error(make_io_error_code(
+        uv_fileno((uv_handle_t*) &tcp_, &fd)));
+    // libuv can't let go of a descriptor without closing it, so a duplicate
+    // survives the handle instead
+    int copy = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy < 0) {
+        throw_if_error(make_io_error_code(uv_translate_sys_error(errno)));
+    }
+    closed_ = true;
+    close_handle(&tcp_);
+    on_closed();
+    return copy;
+}
+
+detached_socket socket_impl::detach()
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    if (reading_) throw io_error{"can't detach while reading"};
+    // Queued writes have to be handed to the OS before the descriptor moves
+    flush();
+    stop_stream_reading();
+    detached_socket detached;
+    detached.streaming_ = streaming_;
+    detached.stream_buf_size_ = stream_buf_.capacity();
+    detached.fd_ = release_fd();
+    // Nothing can be added to the buffer after the handle is closed
+    detached.buffered_.resize(stream_buf_.size());
+    stream_buf_.read(&detached.buffered_[0], detached.buffered_.size());
+    return detached;
+}
+
+void socket_impl::attach(detached_socket&& detached)
+{
+    if (detached.empty()) throw socket_closed_error{};
+    if (DEBUG_LOG) std::cout << "attaching detached socket\n";
+    uv_os_sock_t fd = detached.fd_;
+    detached.fd_ = -1;
+    do_open(fd);
+    const std::string& buffered = detached.buffered_;
+    if (detached.streaming_ || !buffered.empty()) {
+        stream_buf_ = ring_buffer{ std::max<std::size_t>({ 1,
+            detached.stream_buf_size_, buffered.size() }) };
+        std::memcpy(stream_buf_.write_ptr(), buffered.data(), buffered.size());
+        stream_buf_.commit(buffered.size());
+    }
+    streaming_ = detached.streaming_;
+}
+
+void socket_impl::set_open_counter(
+    std::shared_ptr<std::atomic<std::size_t>> counter)
+{
+    open_counter_ = std::move(counter);
+}
+
+void socket_impl::connect(const std::string& host, uint16_t port,
+    const deadline& until)
+{
+    std::error_code ec;
+    connect(host, port, until, ec);
+    throw_if_error(ec);
+}
+
+void socket_impl::connect(const std::string& host, uint16_t port,
+    const deadline& until, std::error_code& ec)
+{
+    ec.clear();
+    if (closed_) {
+        ec = make_io_error_code(UV_ENOTCONN);
+        return;
+    }
+    bind_this_fiber_to_loop(loop_);
+    struct sockaddr_storage numeric_addr;
+    if (parse_ip_address(host, port, numeric_addr)) {
+        ec = make_io_error_code(
+            connect_to((struct sockaddr*) &numeric_addr, until));
+        return;
+    }
+    if (DEBUG_LOG) std::cout << "resolving " << host << ":" << port << "\n";
+    // The resolver reports errors as exceptions, but it only comes into play
+    // for names, which need a lookup anyway
     try {
-        auto addr = getaddrinfo(host, port);
-        if (DEBUG_LOG) std::cout << "connecting to " << host << ":" <<
-            port << "\n";
-        fibers::promise<void> promise;
-        uv_connect_t req;
-        uv_req_set_data((uv_req_t*) &req, &promise);
-        int status = uv_tcp_connect(&req, &tcp_, addr->ai_addr,
-            connection_callback);
-        check_uv_status(status);
-        promise.get_future().get();
+        auto resolved = resolve(host, port);
+        auto candidates = connection_candidates(resolved.get());
+        if (candidates.size() <= 1) {
+            ec = make_io_error_code(connect_to(resolved->ai_addr, until));
+            return;
+        }
+        if (DEBUG_LOG) std::cout << "racing " << candidates.size() <<
+            " addresses of " << host << "\n";
+        uv_os_sock_t fd = race_connections(candidates, until, ec);
+        if (ec) {
+            if (ec.value() == UV_ETIMEDOUT) abort();
+            return;
+        }
+        ec = make_io_error_code(uv_tcp_open(&tcp_, fd));
+        if (ec) ::close(fd);
     } catch (uv_error& e) {
-        throw io_error{ e.what() };
+        ec = make_io_error_code(e.get_status());
     }
 }
 
-std::size_t socket_impl::read(char* buf, std::size_t size)
+int socket_impl::connect_to(const struct sockaddr* addr,
+    const deadline& until)
 {
-    if (closed_) throw socket_closed_error{};
+    if (DEBUG_LOG) std::cout << "connecting\n";
+    completion_slot slot;
+    uv_connect_t req;
+    uv_req_set_data((uv_req_t*) &req, &slot);
+    int status = uv_tcp_connect(&req, &tcp_, addr,
+        complete_request<uv_connect_t>);
+    if (status < 0) return status;
+    if (!slot.wait_until(until)) {
+        if (DEBUG_LOG) std::cout << "connect timed out\n";
+        // Closing the handle cancels the request, which is on our stack
+        abort();
+        slot.wait();
+        return UV_ETIMEDOUT;
+    }
+    return slot.get_status();
+}
+
+std::size_t socket_impl::read(char* buf, std::size_t size,
+    const deadline& until)
+{
+    std::error_code ec;
+    std::size_t bytes_read = read(buf, size, until, ec);
+    throw_if_error(ec);
+    return bytes_read;
+}
+
+std::size_t socket_impl::read(char* buf, std::size_t size,
+    const deadline& until, std::error_code& ec)
+{
+    ec.clear();
+    if (closed_) {
+        ec = make_io_error_code(UV_ENOTCONN);
+        return 0;
+    }
+    bind_this_fiber_to_loop(loop_);
     if (reading_) {
         if (DEBUG_LOG) std::cout << "socket_impl: concurrent read\n";
-        throw io_error{"concurrent read"};
+        ec = make_io_error_code(UV_EBUSY);
+        return 0;
+    }
+    touch_idle_timer();
+    if (streaming_ || !stream_buf_.empty()) {
+        return read_buffered(buf, size, until, ec);
     }
 
+    // Set already for the direct read, since its yield lets other fibers in
     reading_ = true;
+    std::size_t bytes_read = read_unbuffered(buf, size, until, ec);
+    reading_ = false;
+    return bytes_read;
+}
+
+std::size_t socket_impl::read_unbuffered(char* buf, std::size_t size,
+    const deadline& until, std::error_code& ec)
+{
+    // Take data that has already arrived without involving the event loop,
+    // but let other fibers run now and then if data keeps arriving
+    if (++fast_reads_ % FAST_READS_BEFORE_YIELD == 0) {
+        this_fiber::yield();
+        if (closed_) return 0;
+    }
+    int64_t result = try_read(buf, size);
+    if (result >= 0) {
+        return result;
+    } else if (result == UV_EOF) {
+        ec = make_io_error_code(close_with_status());
+        return 0;
+    } else if (result != UV_EAGAIN) {
+        ec = make_io_error_code(result);
+        return 0;
+    }
+    fast_reads_ = 0;
+
     buf_ = buf;
     len_ = size;
-    try {
-        if (DEBUG_LOG) std::cout << "starting read\n";
-        int status =
-            uv_read_start((uv_stream_t*) &tcp_, alloc_callback, read_callback);
-        check_uv_status(status);
-        wait_for_read_to_finish();
-        reading_ = false;
-
-        if (len_ == ERROR_EOF) {
-            close();
-        } else if (len_ == ERROR_READ_FAILED) {
-            throw io_error("read failed");
+    if (DEBUG_LOG) std::cout << "starting read\n";
+    int status =
+        uv_read_start((uv_stream_t*) &tcp_, alloc_callback, read_callback);
+    if (status < 0) {
+        buf_ = 0;
+        ec = make_io_error_code(status);
+        return 0;
+    }
+    const bool finished = wait_for_read_to_finish(until);
+    if (!finished) {
+        if (DEBUG_LOG) std::cout << "read timed out\n";
+        // Nothing was read, so the socket can be used as before
+        uv_read_stop((uv_stream_t*) &tcp_);
+        buf_ = 0;
+        ec = make_io_error_code(UV_ETIMEDOUT);
+        return 0;
+    }
+
+    if (len_ == UV_EOF) {
+        ec = make_io_error_code(close_with_status());
+        return 0;
+    } else if (len_ < 0) {
+        ec = make_io_error_code(len_);
+        return 0;
+    }
+
+    if (closed_) {
+        return 0;
+    }
+    return len_;
+}
+
+int64_t socket_impl::try_read(char* buf, std::size_t size)
+{
+    uv_os_fd_t fd;
+    if (size == 0 || uv_fileno((uv_handle_t*) &tcp_, &fd) != 0) {
+        return UV_EAGAIN;
+    }
+    ssize_t result;
+    do {
+        result = ::recv(fd, buf, size, 0);
+    } while (result < 0 && errno == EINTR);
+
+    if (result > 0) {
+        if (DEBUG_LOG) std::cout << "read " << result << " bytes directly\n";
+        return result;
+    } else if (result == 0) {
+        return UV_EOF;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return UV_EAGAIN;
+    } else {
+        if (DEBUG_LOG) std::cout << "direct read error\n";
+        return uv_translate_sys_error(errno);
+    }
+}
+
+std::size_t socket_impl::read_buffered(char* buf, std::size_t size,
+    const deadline& until, std::error_code& ec)
+{
+    if (streaming_ && !stream_reading_ && !stream_eof_ && !stream_error_) {
+        start_stream_reading();
+    }
+    reading_ = true;
+    bool timed_out = false;
+    dummy_lock lock;
+    while (stream_buf_.empty() && streaming_ && !stream_eof_ &&
+            !stream_error_ && !closed_) {
+        if (DEBUG_LOG) std::cout << "waiting for streamed data\n";
+        if (!wait_until(cond_, lock, until)) {
+            timed_out = true;
+            break;
         }
+    }
+    reading_ = false;
+
+    if (!stream_buf_.empty()) {
+        std::size_t bytes_read = stream_buf_.read(buf, size);
+        if (DEBUG_LOG) std::cout << "read " << bytes_read <<
+            " buffered bytes\n";
+        resume_stream_reading();
+        return bytes_read;
+    } else if (closed_) {
+        return 0;
+    } else if (stream_error_) {
+        ec = make_io_error_code(stream_error_);
+        return 0;
+    } else if (stream_eof_) {
+        ec = make_io_error_code(close_with_status());
+        return 0;
+    } else if (timed_out) {
+        ec = make_io_error_code(UV_ETIMEDOUT);
+        return 0;
+    }
+    // Streaming was turned off while waiting, so read the usual way
+    return read(buf, size, until, ec);
+}
+
+void socket_impl::start_stream_reading()
+{
+    if (DEBUG_LOG) std::cout << "starting streaming read\n";
+    int status = uv_read_start((uv_stream_t*) &tcp_, stream_alloc_callback,
+        stream_read_callback);
+    if (status < 0) {
+        // The next read reports it
+        stream_error_ = status;
+        return;
+    }
+    stream_reading_ = true;
+}
+
+void socket_impl::resume_stream_reading()
+{
+    // Reading pauses when the buffer is full, so resume it when there's space
+    if (streaming_ && !stream_reading_ && !stream_eof_ && !stream_error_ &&
+            !closed_ && !stream_buf_.full()) {
+        start_stream_reading();
+    }
+}
+
+void socket_impl::stop_stream_reading()
+{
+    if (stream_reading_) {
+        if (DEBUG_LOG) std::cout << "stopping streaming read\n";
+        uv_read_stop((uv_stream_t*) &tcp_);
+        stream_reading_ = false;
+    }
+}
 
-        if (closed_) {
-            len_ = 0;
+void socket_impl::get_stream_space(uv_buf_t* buf)
+{
+    buf->base = stream_buf_.write_ptr();
+    buf->len = stream_buf_.write_space();
+}
+
+void socket_impl::on_stream_read(ssize_t nread)
+{
+    if (nread > 0) {
+        if (DEBUG_LOG) std::cout << "streamed " << nread << " bytes\n";
+        stream_buf_.commit(nread);
+        if (stream_buf_.full()) stop_stream_reading();
+    } else if (nread == 0) {
+        // Nothing was read (EAGAIN)
+        return;
+    } else if (nread == UV_ENOBUFS) {
+        stop_stream_reading();
+        return;
+    } else {
+        stop_stream_reading();
+        if (nread == UV_EOF) {
+            stream_eof_ = true;
+        } else {
+            if (DEBUG_LOG) std::cout << "streaming read error\n";
+            stream_error_ = nread;
         }
+    }
+    cond_.notify_all();
+}
 
-        return len_;
-    } catch (std::exception& e) {
-        buf_ = 0;
-        reading_ = false;
-        throw;
+void socket_impl::set_streaming(bool enabled, std::size_t buffer_size)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    if (enabled) {
+        buffer_size = std::max<std::size_t>(1, buffer_size);
+        if (stream_buf_.empty() && stream_buf_.capacity() != buffer_size) {
+            stream_buf_ = ring_buffer{ buffer_size };
+        }
+    } else {
+        stop_stream_reading();
+    }
+    streaming_ = enabled;
+    // Wake up any reader so that it notices the change
+    cond_.notify_all();
+}
+
+std::size_t socket_impl::read(const mutable_buffer* bufs, std::size_t count)
+{
+    std::size_t first = 0;
+    while (first < count && bufs[first].size == 0) first++;
+    if (first == count) {
+        if (closed_) throw socket_closed_error{};
+        return 0;
+    }
+
+    std::size_t bytes_read = read(bufs[first].data, bufs[first].size);
+    if (bytes_read < bufs[first].size || closed_) {
+        return bytes_read;
+    }
+    return bytes_read + read_available(bufs + first + 1, count - first - 1);
+}
+
+std::size_t socket_impl::read_available(const mutable_buffer* bufs,
+    std::size_t count)
+{
+    std::size_t bytes_read = 0;
+    if (streaming_ || !stream_buf_.empty()) {
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t n = stream_buf_.read(bufs[i].data, bufs[i].size);
+            bytes_read += n;
+            if (n < bufs[i].size) break;
+        }
+        resume_stream_reading();
+        return bytes_read;
+    }
+
+    // The socket is non-blocking, so this only takes what has already arrived
+    uv_os_fd_t fd;
+    if (uv_fileno((uv_handle_t*) &tcp_, &fd) != 0) return 0;
+    struct iovec iov[MAX_IOV_COUNT];
+    const std::size_t iov_count = std::min(count, MAX_IOV_COUNT);
+    for (std::size_t i = 0; i < iov_count; i++) {
+        iov[i].iov_base = bufs[i].data;
+        iov[i].iov_len = bufs[i].size;
     }
+    ssize_t result;
+    do {
+        result = ::readv(fd, iov, iov_count);
+    } while (result < 0 && errno == EINTR);
+    // Errors and end-of-stream are left for the next read to discover
+    if (result > 0) {
+        if (DEBUG_LOG) std::cout << "read " << result << " more bytes\n";
+        bytes_read += result;
+    }
+    return bytes_read;
 }
 
-void socket_impl::wait_for_read_to_finish()
+bool socket_impl::wait_for_read_to_finish(const deadline& until)
 {
     if (DEBUG_LOG) std::cout << "waiting for read to finish\n";
     dummy_lock lock;
     while (buf_ != 0 && !closed_) {
-        cond_.wait(lock);
+        if (!wait_until(cond_, lock, until)) {
+            // The read may have finished just as the deadline passed
+            return buf_ == 0 || closed_;
+        }
     }
+    return true;
 }
 
 void socket_impl::on_read_finished(ssize_t nread)
@@ -184,50 +689,487 @@ void socket_impl::on_read_finished(ssize_t nread)
     cond_.notify_all();
 }
 
-void socket_impl::write(const char* data, std::size_t len)
+void socket_impl::write(const char* data, std::size_t len,
+    const deadline& until)
 {
-    if (closed_) throw socket_closed_error{};
-    fibers::promise<void> promise;
+    const const_buffer buf{ data, len };
+    write(&buf, 1, until);
+}
+
+void socket_impl::write(const const_buffer* bufs, std::size_t count,
+    const deadline& until)
+{
+    std::error_code ec;
+    write(bufs, count, until, ec);
+    throw_if_error(ec);
+}
+
+void socket_impl::write(const const_buffer* bufs, std::size_t count,
+    const deadline& until, std::error_code& ec)
+{
+    ec.clear();
+    if (closed_) {
+        ec = make_io_error_code(UV_ENOTCONN);
+        return;
+    }
+    bind_this_fiber_to_loop(loop_);
+    touch_idle_timer();
+    // Queued writes go first
+    int status = wait_for_queued_writes();
+    if (status < 0) {
+        ec = make_io_error_code(status);
+        return;
+    }
+
+    uv_buf_t small_uv_bufs[SMALL_BUF_COUNT];
+    std::vector<uv_buf_t> large_uv_bufs;
+    uv_buf_t* uv_bufs = small_uv_bufs;
+    if (count > SMALL_BUF_COUNT) {
+        large_uv_bufs.resize(count);
+        uv_bufs = large_uv_bufs.data();
+    }
+    std::size_t len = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        // we const_cast since the API incorrectly takes a mutable char* buffer
+        uv_bufs[i].base = const_cast<char*>(bufs[i].data);
+        uv_bufs[i].len = bufs[i].size;
+        len += bufs[i].size;
+    }
+
+    // Write as much as the kernel takes right away without suspending
+    int written = uv_try_write((uv_stream_t*) &tcp_, uv_bufs, count);
+    if (written == UV_EAGAIN || written == UV_ENOSYS) {
+        written = 0;
+    } else if (written < 0) {
+        ec = make_io_error_code(written);
+        return;
+    }
+    if (DEBUG_LOG) std::cout << "wrote " << written << " of " << len <<
+        " bytes directly\n";
+    if (static_cast<std::size_t>(written) == len) return;
+
+    // Skip what was written and wait for the rest to be written
+    std::size_t first = 0;
+    std::size_t bytes_left_to_skip = written;
+    while (bytes_left_to_skip >= uv_bufs[first].len) {
+        bytes_left_to_skip -= uv_bufs[first].len;
+        first++;
+    }
+    uv_bufs[first].base += bytes_left_to_skip;
+    uv_bufs[first].len -= bytes_left_to_skip;
+
+    completion_slot slot;
     uv_write_t req;
-    uv_req_set_data((uv_req_t*) &req, &promise);
+    uv_req_set_data((uv_req_t*) &req, &slot);
+
+    if (DEBUG_LOG) std::cout << "starting write of " << len - written <<
+        " bytes\n";
+    status = uv_write(&req, (uv_stream_t*) &tcp_, uv_bufs + first,
+        count - first, complete_request<uv_write_t>);
+    if (status < 0) {
+        ec = make_io_error_code(status);
+        return;
+    }
+
+    if (!slot.wait_until(until)) {
+        if (DEBUG_LOG) std::cout << "write timed out\n";
+        // A started write can't be taken back, so the connection has to go.
+        // Closing the handle cancels the request, which is on our stack.
+        abort();
+        slot.wait();
+        ec = make_io_error_code(UV_ETIMEDOUT);
+        return;
+    }
+    ec = make_io_error_code(slot.get_status());
+    if (DEBUG_LOG) std::cout << "write finished\n";
+}
+
+std::uint64_t socket_impl::send_file(int file_fd, std::uint64_t offset,
+    std::uint64_t length)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    touch_idle_timer();
+    // Queued writes go first
+    throw_if_error(make_io_error_code(wait_for_queued_writes()));
+    if (length == socket::TO_END_OF_FILE) {
+        struct stat info;
+        if (::fstat(file_fd, &info) < 0) {
+            throw_if_error(make_io_error_code(uv_translate_sys_error(errno)));
+        }
+        const std::uint64_t size = info.st_size;
+        length = offset < size ? size - offset : 0;
+    }
+    if (DEBUG_LOG) std::cout << "sending " << length << " bytes of file\n";
+    std::uint64_t sent = 0;
+#ifdef __linux__
+    sent = send_file_directly(file_fd, offset, length);
+#endif
+    if (sent < length) {
+        sent += copy_file(file_fd, offset + sent, length - sent);
+    }
+    return sent;
+}
+
+std::uint64_t socket_impl::send_file(const std::string& path,
+    std::uint64_t offset, std::uint64_t length)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    int file_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) {
+        throw_if_error(make_io_error_code(uv_translate_sys_error(errno)));
+    }
+    file_closer closer{ file_fd };
+    return send_file(file_fd, offset, length);
+}
+
+std::uint64_t socket_impl::send_file_directly(int file_fd,
+    std::uint64_t offset, std::uint64_t length)
+{
+#ifdef __linux__
+    uv_os_fd_t fd;
+    throw_if_error(make_io_error_code(
+        uv_fileno((uv_handle_t*) &tcp_, &fd)));
+    writable_watcher watcher{ loop_, fd };
+    std::uint64_t sent = 0;
+    while (sent < length) {
+        // A write() of another fiber may still have data with libuv, which
+        // has to go out before the file does
+        if (uv_stream_get_write_queue_size((uv_stream_t*) &tcp_) == 0) {
+            off_t file_offset = offset + sent;
+            const std::size_t chunk =
+                std::min<std::uint64_t>(length - sent, MAX_SENDFILE_CHUNK);
+            ssize_t result = ::sendfile(fd, file_fd, &file_offset, chunk);
+            if (result > 0) {
+                sent += result;
+                continue;
+            } else if (result == 0) {
+                throw io_error{"file ended before the range was sent"};
+            } else if (errno == EINVAL || errno == ENOSYS) {
+                if (DEBUG_LOG) std::cout << "can't sendfile() this file\n";
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                throw_if_error(make_io_error_code(
+                    uv_translate_sys_error(errno)));
+            }
+        }
+        int status = watcher.wait();
+        if (closed_) throw socket_closed_error{};
+        throw_if_error(make_io_error_code(status));
+    }
+    return sent;
+#else
+    return 0;
+#endif
+}
 
-    // we const_cast since the API incorrectly takes a mutable char* buffer
+std::uint64_t socket_impl::copy_file(int file_fd, std::uint64_t offset,
+    std::uint64_t length)
+{
+    pooled_block_ptr block{ acquire_pooled_block(FILE_COPY_BLOCK_SIZE) };
+    char* buf = get_block_data(block.get());
+    std::uint64_t sent = 0;
+    while (sent < length) {
+        const std::size_t chunk =
+            std::min<std::uint64_t>(length - sent, FILE_COPY_BLOCK_SIZE);
+        ssize_t result = ::pread(file_fd, buf, chunk, offset + sent);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            throw_if_error(make_io_error_code(uv_translate_sys_error(errno)));
+        } else if (result == 0) {
+            throw io_error{"file ended before the range was sent"};
+        }
+        const const_buffer data{ buf, static_cast<std::size_t>(result) };
+        write(&data, 1);
+        sent += result;
+    }
+    return sent;
+}
+
+void socket_impl::write_async(const char* data, std::size_t len)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    touch_idle_timer();
+    check_write_error();
+    std::size_t written = try_write(data, len);
+    if (written < len) {
+        wait_for_write_queue(len - written);
+        pending_write_.append(data + written, len - written);
+        queued_bytes_ += len - written;
+        start_queued_write();
+    }
+}
+
+void socket_impl::write_async(std::string&& data)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    touch_idle_timer();
+    check_write_error();
+    std::size_t written = try_write(data.data(), data.size());
+    if (written < data.size()) {
+        const std::size_t len = data.size() - written;
+        wait_for_write_queue(len);
+        if (pending_write_.empty()) {
+            // Take over the caller's buffer instead of copying it
+            pending_write_ = std::move(data);
+            pending_offset_ = written;
+        } else {
+            pending_write_.append(data, written, std::string::npos);
+        }
+        queued_bytes_ += len;
+        start_queued_write();
+    }
+}
+
+std::size_t socket_impl::try_write(const char* data, std::size_t len)
+{
+    // Writing directly would jump ahead of queued writes
+    if (queued_bytes_ > 0) return 0;
     const uv_buf_t bufs[] {{
         .base = const_cast<char*>(data),
         .len = len
     }};
+    int written = uv_try_write((uv_stream_t*) &tcp_, bufs, 1);
+    if (written == UV_EAGAIN || written == UV_ENOSYS) {
+        return 0;
+    }
+    if (written < 0) throw_if_error(make_io_error_code(written));
+    return written;
+}
 
-    if (DEBUG_LOG) std::cout << "starting write of " << len << " bytes\n";
-    int status = uv_write(&req, (uv_stream_t*) &tcp_, bufs, 1, write_callback);
-    check_uv_status(status);
+void socket_impl::wait_for_write_queue(std::size_t len)
+{
+    dummy_lock lock;
+    while (queued_bytes_ > 0 && queued_bytes_ + len > write_queue_limit_ &&
+            !closed_) {
+        if (DEBUG_LOG) std::cout << "write queue is full\n";
+        write_cond_.wait(lock);
+    }
+    if (closed_) throw socket_closed_error{};
+    check_write_error();
+}
 
-    promise.get_future().get();
-    if (DEBUG_LOG) std::cout << "write finished\n";
+void socket_impl::start_queued_write()
+{
+    // Everything queued while a write is in progress is written together
+    if (writing_async_ || pending_write_.empty()) return;
+    write_pending();
+}
+
+void socket_impl::write_pending()
+{
+    std::unique_ptr<queued_write> write{ new queued_write };
+    write->socket = this;
+    write->data.swap(pending_write_);
+    write->offset = pending_offset_;
+    pending_offset_ = 0;
+    uv_req_set_data((uv_req_t*) &write->req, write.get());
+    const std::size_t len = write->data.size() - write->offset;
+    const uv_buf_t bufs[] {{
+        .base = &write->data[0] + write->offset,
+        .len = len
+    }};
+    if (DEBUG_LOG) std::cout << "starting queued write of " << len <<
+        " bytes\n";
+    int status = uv_write(&write->req, (uv_stream_t*) &tcp_, bufs, 1,
+        async_write_callback);
+    if (status < 0) {
+        on_async_write_finished(len, status);
+        return;
+    }
+    write.release();
+    writing_async_ = true;
+}
+
+void socket_impl::on_async_write_finished(std::size_t len, int status)
+{
+    if (DEBUG_LOG) std::cout << "queued write of " << len << " bytes done\n";
+    writing_async_ = false;
+    queued_bytes_ -= len;
+    if (status < 0) {
+        if (write_error_ == 0) write_error_ = status;
+        // The connection is broken, so there's no point in writing the rest
+        queued_bytes_ = 0;
+        pending_write_.clear();
+        pending_offset_ = 0;
+    } else if (!closed_) {
+        start_queued_write();
+    }
+    write_cond_.notify_all();
+}
+
+void socket_impl::check_write_error()
+{
+    if (write_error_ < 0) {
+        int status = write_error_;
+        write_error_ = 0;
+        throw_if_error(make_io_error_code(status));
+    }
+}
+
+void socket_impl::flush()
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    throw_if_error(make_io_error_code(wait_for_queued_writes()));
+}
+
+int socket_impl::wait_for_queued_writes()
+{
+    dummy_lock lock;
+    while (queued_bytes_ > 0 && !closed_) {
+        write_cond_.wait(lock);
+    }
+    if (closed_) return UV_ENOTCONN;
+    int status = write_error_;
+    write_error_ = 0;
+    return status;
+}
+
+void socket_impl::set_write_queue_limit(std::size_t bytes)
+{
+    write_queue_limit_ = bytes;
+    write_cond_.notify_all();
 }
 
 void socket_impl::close()
+{
+    throw_if_error(make_io_error_code(close_with_status()));
+}
+
+int socket_impl::close_with_status()
+{
+    if (closed_) return 0;
+    bind_this_fiber_to_loop(loop_);
+    closed_ = true;
+    if (DEBUG_LOG) std::cout << "closing socket_impl\n";
+    // Nothing starts the rest of the write queue once closed_ is set, so
+    // it's handed over now. The shutdown waits for it to be written.
+    if (!pending_write_.empty()) write_pending();
+    int status = shutdown();
+    close_handle(&tcp_);
+    on_closed();
+    if (status == UV_ENOTCONN || status == UV_EBADF) {
+        if (DEBUG_LOG) std::cout << "Closed disconnected socket\n";
+        return 0;
+    }
+    return status;
+}
+
+void socket_impl::close(socket::close_mode mode)
+{
+    if (mode == socket::close_mode::wait) {
+        close();
+    } else if (!closed_) {
+        close_in_background(mode == socket::close_mode::abortive);
+    }
+}
+
+void socket_impl::close_in_background(bool reset)
+{
+    bind_this_fiber_to_loop(loop_);
+    if (DEBUG_LOG) std::cout << "closing socket_impl in the background\n";
+    closed_ = true;
+    // Waiting reads return once they see closed_, so nothing may be read into
+    // their buffers after this
+    uv_read_stop((uv_stream_t*) &tcp_);
+    stream_reading_ = false;
+    on_closed();
+    // The handle lives in this object, so it has to outlive the close
+    refs_++;
+    if (reset) {
+        uv_os_fd_t fd;
+        if (uv_fileno((uv_handle_t*) &tcp_, &fd) == 0) {
+            struct linger lin{ 1, 0 };
+            ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        }
+    } else {
+        // Queued writes don't continue after a close, so everything goes to
+        // libuv now, which shuts down once it's written
+        if (!pending_write_.empty()) write_pending();
+        int status = uv_shutdown(&background_shutdown_, (uv_stream_t*) &tcp_,
+            background_shutdown_callback);
+        if (status == 0) return;
+    }
+    uv_close((uv_handle_t*) &tcp_, background_close_callback);
+}
+
+void socket_impl::set_options(const tcp_options& options)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    throw_if_error(make_io_error_code(
+        apply_options(options, tcp_option_set::all)));
+}
+
+int socket_impl::apply_options(const tcp_options& options,
+    tcp_option_set which)
+{
+    uv_os_fd_t fd;
+    int status = uv_fileno((uv_handle_t*) &tcp_, &fd);
+    if (status < 0) return status;
+    return apply_tcp_options(fd, options, which);
+}
+
+void socket_impl::set_idle_timeout(std::chrono::milliseconds timeout)
+{
+    if (closed_) throw socket_closed_error{};
+    bind_this_fiber_to_loop(loop_);
+    if (!wheel_) wheel_ = get_timer_wheel();
+    if (timeout.count() > 0) {
+        wheel_->schedule(idle_entry_, timeout.count());
+    } else {
+        wheel_->cancel(idle_entry_);
+    }
+}
+
+void socket_impl::on_idle_timeout()
+{
+    if (DEBUG_LOG) std::cout << "idle timeout expired\n";
+    // This runs inside the loop, so it can't wait for a proper close. Shutting
+    // the connection down makes waiting reads see the end of the stream and
+    // writes fail, and the fiber that owns the socket takes it from there.
+    uv_os_fd_t fd;
+    if (uv_fileno((uv_handle_t*) &tcp_, &fd) == 0) {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+}
+
+void socket_impl::on_closed()
+{
+    if (wheel_) wheel_->cancel(idle_entry_);
+    cond_.notify_all();
+    write_cond_.notify_all();
+    if (open_counter_) {
+        open_counter_->fetch_sub(1);
+        open_counter_.reset();
+    }
+}
+
+void socket_impl::abort()
 {
     if (!closed_) {
+        if (DEBUG_LOG) std::cout << "aborting socket_impl\n";
         closed_ = true;
-        if (DEBUG_LOG) std::cout << "closing socket_impl\n";
-        try {
-            shutdown();
-        } catch (socket_closed_error& e) {
-            if (DEBUG_LOG) std::cout << "Closing disconnected socket\n";
-        }
         close_handle(&tcp_);
-        cond_.notify_all();
+        on_closed();
     }
 }
 
-void socket_impl::shutdown()
+int socket_impl::shutdown()
 {
-    fibers::promise<void> promise;
+    completion_slot slot;
     uv_shutdown_t req;
-    uv_req_set_data((uv_req_t*) &req, &promise);
-    int status = uv_shutdown(&req, (uv_stream_t*) &tcp_, shutdown_callback);
-    check_uv_status(status);
-    promise.get_future().get();
+    uv_req_set_data((uv_req_t*) &req, &slot);
+    int status = uv_shutdown(&req, (uv_stream_t*) &tcp_,
+        complete_request<uv_shutdown_t>);
+    if (status < 0) return status;
+    return slot.wait();
 }
 
 bool socket_impl::is_open()
@@ -235,4 +1177,22 @@ bool socket_impl::is_open()
     return !closed_;
 }
 
+bool socket_impl::is_idle_and_alive()
+{
+    if (closed_ || reading_ || queued_bytes_ > 0 || write_error_ < 0 ||
+            !stream_buf_.empty()) {
+        return false;
+    }
+    uv_os_fd_t fd;
+    if (uv_fileno((uv_handle_t*) &tcp_, &fd) != 0) return false;
+    // An idle connection has nothing to read. The end of the stream means the
+    // peer closed it, and data means the last exchange didn't end cleanly.
+    char c;
+    ssize_t result;
+    do {
+        result = ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    } while (result < 0 && errno == EINTR);
+    return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
 }
@@ -1,8 +1,19 @@
 #ifndef _FIBERIO_SRC_SOCKET_IMPL_H_
 #define _FIBERIO_SRC_SOCKET_IMPL_H_
 
+#include "ring_buffer.hpp"
+#include "tcp_options_impl.hpp"
+#include "timer_wheel.hpp"
+#include "utils.hpp"
+#include <fiberio/socket.hpp>
 #include <boost/fiber/all.hpp>
-#include<string>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <system_error>
 #include <uv.h>
 
 namespace fiberio {
@@ -14,38 +25,200 @@ public:
 
     ~socket_impl();
 
-    void do_accept(uv_stream_t* server);
+    // The memory comes from a free list of the thread's loop
+    static void* operator new(std::size_t size);
 
-    void connect(const std::string& host, uint16_t port);
+    static void operator delete(void* storage, std::size_t size) noexcept;
 
-    std::size_t read(char* buf, std::size_t size);
+    //! Returns the libuv status
+    int do_accept(uv_stream_t* server);
 
-    void write(const char* data, std::size_t len);
+    void do_open(uv_os_sock_t fd);
+
+    uv_os_sock_t release_fd();
+
+    detached_socket detach();
+
+    void attach(detached_socket&& detached);
+
+    void set_open_counter(
+        std::shared_ptr<std::atomic<std::size_t>> counter);
+
+    void connect(const std::string& host, uint16_t port,
+        const deadline& until = NO_DEADLINE);
+
+    void connect(const std::string& host, uint16_t port,
+        const deadline& until, std::error_code& ec);
+
+    std::size_t read(char* buf, std::size_t size,
+        const deadline& until = NO_DEADLINE);
+
+    std::size_t read(char* buf, std::size_t size, const deadline& until,
+        std::error_code& ec);
+
+    std::size_t read(const mutable_buffer* bufs, std::size_t count);
+
+    void write(const char* data, std::size_t len,
+        const deadline& until = NO_DEADLINE);
+
+    void write(const const_buffer* bufs, std::size_t count,
+        const deadline& until = NO_DEADLINE);
+
+    void write(const const_buffer* bufs, std::size_t count,
+        const deadline& until, std::error_code& ec);
+
+    std::uint64_t send_file(int file_fd, std::uint64_t offset,
+        std::uint64_t length);
+
+    std::uint64_t send_file(const std::string& path, std::uint64_t offset,
+        std::uint64_t length);
+
+    void write_async(const char* data, std::size_t len);
+
+    void write_async(std::string&& data);
+
+    void flush();
+
+    void set_write_queue_limit(std::size_t bytes);
+
+    void on_async_write_finished(std::size_t len, int status);
+
+    void set_streaming(bool enabled, std::size_t buffer_size);
+
+    void set_options(const tcp_options& options);
+
+    //! Sets some of the options and returns the libuv status
+    int apply_options(const tcp_options& options, tcp_option_set which);
+
+    void set_idle_timeout(std::chrono::milliseconds timeout);
+
+    void on_idle_timeout();
 
     void close();
 
+    //! Closes like close(), but returns the shutdown's status instead of
+    //! throwing it
+    int close_with_status();
+
+    void close(socket::close_mode mode);
+
+    void set_close_mode_on_destroy(socket::close_mode mode) {
+        close_mode_on_destroy_ = mode;
+    }
+
     bool is_open();
 
+    //! True if the connection is open and nothing arrived that wasn't read
+    bool is_idle_and_alive();
+
     void on_read_finished(int64_t nread);
 
     char* get_buf() { return buf_; }
 
     int64_t get_len() { return len_; }
 
+    void get_stream_space(uv_buf_t* buf);
+
+    void on_stream_read(ssize_t nread);
+
 private:
-    void wait_for_read_to_finish();
+    friend void intrusive_ptr_add_ref(socket_impl* impl);
+    friend void intrusive_ptr_release(socket_impl* impl);
+
+    bool wait_for_read_to_finish(const deadline& until);
+
+    //! Returns the bytes read or a libuv status, e.g. UV_EAGAIN or UV_EOF
+    int64_t try_read(char* buf, std::size_t size);
+
+    std::size_t read_buffered(char* buf, std::size_t size,
+        const deadline& until, std::error_code& ec);
+
+    //! Reads directly or through libuv; expects reading_ to be set
+    std::size_t read_unbuffered(char* buf, std::size_t size,
+        const deadline& until, std::error_code& ec);
+
+    std::size_t read_available(const mutable_buffer* bufs, std::size_t count);
+
+    std::size_t try_write(const char* data, std::size_t len);
+
+    //! Sends with sendfile(2) and returns early if the file doesn't support it
+    std::uint64_t send_file_directly(int file_fd, std::uint64_t offset,
+        std::uint64_t length);
+
+    //! Sends by reading the file into a buffer and writing that
+    std::uint64_t copy_file(int file_fd, std::uint64_t offset,
+        std::uint64_t length);
+
+    void wait_for_write_queue(std::size_t len);
+
+    //! Returns UV_ENOTCONN if closed, or the error of a queued write
+    int wait_for_queued_writes();
+
+    void start_queued_write();
+
+    //! Starts writing pending_write_ even if another write is in progress
+    void write_pending();
 
-    void shutdown();
+    void check_write_error();
 
+    void start_stream_reading();
+
+    void resume_stream_reading();
+
+    void stop_stream_reading();
+
+    int shutdown();
+
+    //! Connects the handle to a single address and returns the libuv status
+    int connect_to(const struct sockaddr* addr, const deadline& until);
+
+    void abort();
+
+    //! Lets the loop close the handle and drop a reference afterwards
+    void close_in_background(bool reset);
+
+    void on_closed();
+
+    void touch_idle_timer() {
+        if (idle_entry_.linked) wheel_->touch(idle_entry_);
+    }
+
+    // Only used from the thread that owns the socket, so it's not atomic
+    std::size_t refs_;
     uv_loop_t* loop_;
     uv_tcp_t tcp_;
     boost::fibers::condition_variable_any cond_;
+    boost::fibers::condition_variable_any write_cond_;
     bool closed_ : 1;
     bool reading_ : 1;
+    bool streaming_ : 1;
+    bool stream_reading_ : 1;
+    bool stream_eof_ : 1;
+    unsigned fast_reads_;
+    int stream_error_;
     char* buf_;
     int64_t len_;
+    ring_buffer stream_buf_;
+    std::size_t write_queue_limit_;
+    std::size_t queued_bytes_;
+    std::string pending_write_;
+    std::size_t pending_offset_;
+    bool writing_async_;
+    int write_error_;
+    std::shared_ptr<std::atomic<std::size_t>> open_counter_;
+    timer_wheel* wheel_;
+    timer_wheel_entry idle_entry_;
+    socket::close_mode close_mode_on_destroy_;
+    uv_shutdown_t background_shutdown_;
 };
 
+using socket_impl_ptr = boost::intrusive_ptr<socket_impl>;
+
+inline socket_impl_ptr make_socket_impl()
+{
+    return socket_impl_ptr{ new socket_impl{} };
+}
+
 }
 
 #endif
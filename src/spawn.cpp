@@ -0,0 +1,157 @@
+#include <fiberio/spawn.hpp>
+#include <boost/context/stack_traits.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(BOOST_USE_VALGRIND)
+#include <valgrind/valgrind.h>
+#endif
+
+namespace ctx = boost::context;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Each kind of stack keeps at most this many unused stacks per thread
+const std::size_t MAX_CACHED_STACKS = 256;
+
+thread_local bool stack_pool_destroyed = false;
+
+std::size_t round_up(std::size_t size, std::size_t multiple)
+{
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+//! Maps size bytes, aligned to alignment (a multiple of the page size)
+void* map_memory(std::size_t size, std::size_t alignment)
+{
+    const std::size_t page_size = ctx::stack_traits::page_size();
+    const std::size_t extra = alignment > page_size ? alignment : 0;
+    void* memory = ::mmap(nullptr, size + extra, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (memory == MAP_FAILED) throw std::bad_alloc{};
+    if (extra == 0) return memory;
+    // Unmap what's left over on both sides of the aligned range
+    char* start = static_cast<char*>(memory);
+    char* aligned = reinterpret_cast<char*>(
+        round_up(reinterpret_cast<std::uintptr_t>(start), alignment));
+    if (aligned > start) ::munmap(start, aligned - start);
+    char* end = start + size + extra;
+    if (end > aligned + size) ::munmap(aligned + size, end - aligned - size);
+    return aligned;
+}
+
+//! The unused stacks with one combination of options
+struct stack_list
+{
+    std::size_t size;
+    bool huge_pages;
+    bool guard_page;
+    std::vector<void*> stacks;
+};
+
+class stack_pool
+{
+public:
+    ~stack_pool() {
+        for (auto& list : lists_) {
+            for (auto stack : list.stacks) {
+                ::munmap(stack, list.size);
+            }
+        }
+        stack_pool_destroyed = true;
+    }
+
+    std::vector<void*>& get_list(std::size_t size, bool huge_pages,
+        bool guard_page) {
+        for (auto& list : lists_) {
+            if (list.size == size && list.huge_pages == huge_pages &&
+                    list.guard_page == guard_page) {
+                return list.stacks;
+            }
+        }
+        lists_.push_back(stack_list{ size, huge_pages, guard_page, {} });
+        return lists_.back().stacks;
+    }
+
+private:
+    std::vector<stack_list> lists_;
+};
+
+thread_local stack_pool thread_stack_pool;
+
+}
+
+pooled_stack_allocator::pooled_stack_allocator(const stack_options& options)
+    : huge_pages_{ options.huge_pages }, guard_page_{ options.guard_page }
+{
+    const std::size_t page_size = ctx::stack_traits::page_size();
+    std::size_t size = options.size;
+    if (size == 0) size = ctx::stack_traits::default_size();
+    size = std::max(size, ctx::stack_traits::minimum_size());
+    if (guard_page_) size += page_size;
+    size_ = round_up(size, huge_pages_ ? HUGE_PAGE_SIZE : page_size);
+}
+
+ctx::stack_context pooled_stack_allocator::allocate()
+{
+    void* stack = nullptr;
+    if (!stack_pool_destroyed) {
+        auto& stacks = thread_stack_pool.get_list(size_, huge_pages_,
+            guard_page_);
+        if (!stacks.empty()) {
+            stack = stacks.back();
+            stacks.pop_back();
+        }
+    }
+    if (!stack) {
+        if (DEBUG_LOG) std::cout << "mapping stack of " << size_ <<
+            " bytes\n";
+        stack = map_memory(size_, huge_pages_ ? HUGE_PAGE_SIZE : 0);
+        if (huge_pages_) ::madvise(stack, size_, MADV_HUGEPAGE);
+        // The stack grows down, so the guard page is at the lowest address
+        if (guard_page_) {
+            ::mprotect(stack, ctx::stack_traits::page_size(), PROT_NONE);
+        }
+    }
+    ctx::stack_context sctx;
+    sctx.size = size_;
+    sctx.sp = static_cast<char*>(stack) + size_;
+#if defined(BOOST_USE_VALGRIND)
+    sctx.valgrind_stack_id = VALGRIND_STACK_REGISTER(sctx.sp, stack);
+#endif
+    return sctx;
+}
+
+void pooled_stack_allocator::deallocate(ctx::stack_context& sctx) noexcept
+{
+#if defined(BOOST_USE_VALGRIND)
+    VALGRIND_STACK_DEREGISTER(sctx.valgrind_stack_id);
+#endif
+    void* stack = static_cast<char*>(sctx.sp) - sctx.size;
+    if (!stack_pool_destroyed) {
+        try {
+            auto& stacks = thread_stack_pool.get_list(size_, huge_pages_,
+                guard_page_);
+            if (stacks.size() < MAX_CACHED_STACKS) {
+                stacks.push_back(stack);
+                return;
+            }
+        } catch (std::bad_alloc& e) {
+            // Unmapping it is fine too
+        }
+    }
+    ::munmap(stack, sctx.size);
+}
+
+}
@@ -0,0 +1,144 @@
+#include "tcp_options_impl.hpp"
+#include <iostream>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+#ifdef __linux__
+// Linux copies everything but TCP_QUICKACK from the listening socket to the
+// sockets it accepts. Elsewhere, each accepted socket is tuned on its own.
+const bool INHERITS_OPTIONS = true;
+#else
+const bool INHERITS_OPTIONS = false;
+#endif
+
+int set_int_option(uv_os_sock_t fd, int level, int name, int value)
+{
+    if (DEBUG_LOG) std::cout << "setting socket option " << name << " to " <<
+        value << "\n";
+    if (::setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        return uv_translate_sys_error(errno);
+    }
+    return 0;
+}
+
+//! Returns true if an option that Linux copies (or doesn't) is in the set
+bool includes(tcp_option_set which, bool copied_on_linux)
+{
+    const bool inherited = INHERITS_OPTIONS && copied_on_linux;
+    switch (which) {
+    case tcp_option_set::inherited:
+        return inherited;
+    case tcp_option_set::not_inherited:
+        return !inherited;
+    default:
+        return true;
+    }
+}
+
+}
+
+bool has_tcp_options(const tcp_options& options, tcp_option_set which)
+{
+    const bool most = options.no_delay || options.keepalive_idle.count() ||
+        options.keepalive_interval.count() || options.keepalive_count ||
+        options.send_buffer_size || options.receive_buffer_size ||
+        options.busy_poll.count();
+    return (most && includes(which, true)) ||
+        (options.quick_ack && includes(which, false));
+}
+
+int apply_tcp_options(uv_os_sock_t fd, const tcp_options& options,
+    tcp_option_set which)
+{
+    int status = 0;
+    if (includes(which, true)) {
+        if (options.no_delay) {
+            status = set_int_option(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+            if (status < 0) return status;
+        }
+        if (options.keepalive_idle.count() > 0) {
+            status = set_int_option(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+            if (status < 0) return status;
+#ifdef TCP_KEEPIDLE
+            status = set_int_option(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+                options.keepalive_idle.count());
+#else
+            status = set_int_option(fd, IPPROTO_TCP, TCP_KEEPALIVE,
+                options.keepalive_idle.count());
+#endif
+            if (status < 0) return status;
+        }
+        if (options.keepalive_interval.count() > 0) {
+            status = set_int_option(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+                options.keepalive_interval.count());
+            if (status < 0) return status;
+        }
+        if (options.keepalive_count > 0) {
+            status = set_int_option(fd, IPPROTO_TCP, TCP_KEEPCNT,
+                options.keepalive_count);
+            if (status < 0) return status;
+        }
+        if (options.send_buffer_size > 0) {
+            status = set_int_option(fd, SOL_SOCKET, SO_SNDBUF,
+                options.send_buffer_size);
+            if (status < 0) return status;
+        }
+        if (options.receive_buffer_size > 0) {
+            status = set_int_option(fd, SOL_SOCKET, SO_RCVBUF,
+                options.receive_buffer_size);
+            if (status < 0) return status;
+        }
+        if (options.busy_poll.count() > 0) {
+#ifdef SO_BUSY_POLL
+            status = set_int_option(fd, SOL_SOCKET, SO_BUSY_POLL,
+                options.busy_poll.count());
+            if (status < 0) return status;
+#else
+            return UV_ENOTSUP;
+#endif
+        }
+    }
+    if (includes(which, false) && options.quick_ack) {
+#ifdef TCP_QUICKACK
+        status = set_int_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+        if (status < 0) return status;
+#else
+        return UV_ENOTSUP;
+#endif
+    }
+    return 0;
+}
+
+int apply_listen_options(uv_os_sock_t fd, const listen_options& options)
+{
+    int status = 0;
+    if (options.defer_accept.count() > 0) {
+#ifdef TCP_DEFER_ACCEPT
+        status = set_int_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+            options.defer_accept.count());
+        if (status < 0) return status;
+#else
+        return UV_ENOTSUP;
+#endif
+    }
+    if (options.fast_open_queue > 0) {
+#ifdef TCP_FASTOPEN
+        status = set_int_option(fd, IPPROTO_TCP, TCP_FASTOPEN,
+            options.fast_open_queue);
+        if (status < 0) return status;
+#else
+        return UV_ENOTSUP;
+#endif
+    }
+    return 0;
+}
+
+}
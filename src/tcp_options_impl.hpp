@@ -0,0 +1,35 @@
+#ifndef _FIBERIO_SRC_TCP_OPTIONS_IMPL_H_
+#define _FIBERIO_SRC_TCP_OPTIONS_IMPL_H_
+
+#include <fiberio/tcp_options.hpp>
+#include <uv.h>
+
+namespace fiberio {
+
+//! Which of the tcp_options apply_tcp_options() sets
+enum class tcp_option_set
+{
+    all,
+    //! The ones that accepted sockets copy from the listening socket
+    inherited,
+    //! The ones that have to be set on each accepted socket
+    not_inherited
+};
+
+//! Returns true if some of the options in the set aren't left at defaults
+bool has_tcp_options(const tcp_options& options, tcp_option_set which);
+
+/*! \brief Sets the options of the set that aren't left at their defaults
+ *
+ * Returns a libuv status. UV_ENOTSUP means that an option doesn't exist on
+ * this system.
+ */
+int apply_tcp_options(uv_os_sock_t fd, const tcp_options& options,
+    tcp_option_set which);
+
+//! Sets the listen_options that aren't left at their defaults
+int apply_listen_options(uv_os_sock_t fd, const listen_options& options);
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include "timer_wheel.hpp"
+#include "loop.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+void tick_callback(uv_timer_t* handle)
+{
+    void* data = uv_handle_get_data((uv_handle_t*) handle);
+    static_cast<timer_wheel*>(data)->on_tick();
+}
+
+}
+
+constexpr std::uint64_t timer_wheel::TICK_MS;
+constexpr std::size_t timer_wheel::SLOT_COUNT;
+
+timer_wheel::timer_wheel()
+    : loop_{nullptr}, timer_ready_{false}, current_tick_{0}, count_{0},
+      slots_{}
+{
+}
+
+void timer_wheel::schedule(timer_wheel_entry& entry, std::uint64_t timeout_ms)
+{
+    if (!timer_ready_) {
+        loop_ = get_uv_loop();
+        uv_timer_init(loop_, &timer_);
+        uv_handle_set_data((uv_handle_t*) &timer_, this);
+        timer_ready_ = true;
+    }
+    if (entry.linked) unlink(entry);
+    if (count_ == 0) {
+        if (DEBUG_LOG) std::cout << "starting timer wheel\n";
+        current_tick_ = now_tick();
+        uv_timer_start(&timer_, tick_callback, TICK_MS, TICK_MS);
+    }
+    entry.ticks = std::max<std::uint64_t>(1,
+        (timeout_ms + TICK_MS - 1) / TICK_MS);
+    entry.deadline = now_tick() + entry.ticks;
+    link(entry);
+}
+
+void timer_wheel::cancel(timer_wheel_entry& entry)
+{
+    if (!entry.linked) return;
+    unlink(entry);
+    if (count_ == 0) {
+        if (DEBUG_LOG) std::cout << "stopping timer wheel\n";
+        uv_timer_stop(&timer_);
+    }
+}
+
+void timer_wheel::close()
+{
+    if (timer_ready_) {
+        close_handle((uv_handle_t*) &timer_);
+        timer_ready_ = false;
+    }
+}
+
+void timer_wheel::link(timer_wheel_entry& entry)
+{
+    // Slots up to current_tick_ were already handled in this round
+    const std::uint64_t tick = std::max(entry.deadline, current_tick_ + 1);
+    entry.slot = tick % SLOT_COUNT;
+    entry.prev = nullptr;
+    entry.next = slots_[entry.slot];
+    if (entry.next) entry.next->prev = &entry;
+    slots_[entry.slot] = &entry;
+    entry.linked = true;
+    count_++;
+}
+
+void timer_wheel::unlink(timer_wheel_entry& entry)
+{
+    if (entry.prev) {
+        entry.prev->next = entry.next;
+    } else {
+        slots_[entry.slot] = entry.next;
+    }
+    if (entry.next) entry.next->prev = entry.prev;
+    entry.prev = nullptr;
+    entry.next = nullptr;
+    entry.linked = false;
+    count_--;
+}
+
+void timer_wheel::on_tick()
+{
+    const std::uint64_t now = now_tick();
+    // After a long stall, one pass over all the slots is enough
+    std::uint64_t tick = std::max(current_tick_ + 1,
+        now >= SLOT_COUNT ? now - SLOT_COUNT + 1 : 0);
+    for (; tick <= now && count_ > 0; tick++) {
+        current_tick_ = tick;
+        expire_slot(tick);
+    }
+    current_tick_ = now;
+    if (count_ == 0) {
+        if (DEBUG_LOG) std::cout << "stopping timer wheel\n";
+        uv_timer_stop(&timer_);
+    }
+}
+
+void timer_wheel::expire_slot(std::uint64_t tick)
+{
+    const std::size_t slot = tick % SLOT_COUNT;
+    timer_wheel_entry* entry = slots_[slot];
+    while (entry) {
+        timer_wheel_entry* next = entry->next;
+        if (entry->deadline <= tick) {
+            unlink(*entry);
+            entry->callback(entry);
+        } else if (entry->deadline % SLOT_COUNT != slot) {
+            // It was touched since it was put here
+            unlink(*entry);
+            link(*entry);
+        }
+        entry = next;
+    }
+}
+
+}
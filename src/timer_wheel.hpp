@@ -0,0 +1,86 @@
+#ifndef _FIBERIO_SRC_TIMER_WHEEL_H_
+#define _FIBERIO_SRC_TIMER_WHEEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <uv.h>
+
+namespace fiberio {
+
+//! A timeout in a timer_wheel, meant to be embedded in the object it's for
+struct timer_wheel_entry
+{
+    timer_wheel_entry* prev = nullptr;
+    timer_wheel_entry* next = nullptr;
+    //! The tick at which it expires
+    std::uint64_t deadline = 0;
+    //! The timeout in ticks, used by touch()
+    std::uint64_t ticks = 0;
+    std::size_t slot = 0;
+    bool linked = false;
+    //! Called from the loop when the entry expires, after it was removed
+    void (*callback)(timer_wheel_entry* entry) = nullptr;
+    void* data = nullptr;
+};
+
+/*! \brief Hashed timer wheel for many coarse timeouts on one loop
+ *
+ * Entries are kept in doubly linked lists, one per slot, so arming and
+ * cancelling doesn't allocate. touch() only moves the deadline forward and
+ * leaves the entry where it is. The entry is moved to the right slot when
+ * its old slot comes up, which makes re-arming on every read or write cheap.
+ *
+ * A single uv timer ticks every TICK_MS milliseconds while there are entries.
+ */
+class timer_wheel
+{
+public:
+    static constexpr std::uint64_t TICK_MS = 100;
+
+    static constexpr std::size_t SLOT_COUNT = 512;
+
+    timer_wheel();
+
+    //! Arms or re-arms entry to expire after timeout_ms
+    void schedule(timer_wheel_entry& entry, std::uint64_t timeout_ms);
+
+    //! Pushes the deadline of an armed entry to its timeout from now
+    void touch(timer_wheel_entry& entry) {
+        entry.deadline = now_tick() + entry.ticks;
+    }
+
+    void cancel(timer_wheel_entry& entry);
+
+    //! Closes the uv timer. Entries must be cancelled first.
+    void close();
+
+    std::size_t size() const { return count_; }
+
+    void on_tick();
+
+    // Non-copyable and non-movable
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+    timer_wheel(timer_wheel&&) = delete;
+    timer_wheel& operator=(timer_wheel&&) = delete;
+
+private:
+    std::uint64_t now_tick() const { return uv_now(loop_) / TICK_MS; }
+
+    void link(timer_wheel_entry& entry);
+
+    void unlink(timer_wheel_entry& entry);
+
+    void expire_slot(std::uint64_t tick);
+
+    uv_loop_t* loop_;
+    uv_timer_t timer_;
+    bool timer_ready_;
+    std::uint64_t current_tick_;
+    std::size_t count_;
+    timer_wheel_entry* slots_[SLOT_COUNT];
+};
+
+}
+
+#endif
@@ -15,21 +15,20 @@ void on_handle_closed(uv_handle_t* handle)
 {
     if (DEBUG_LOG) std::cout << "handle was closed\n";
     void* data = uv_handle_get_data(handle);
-    fibers::promise<void>* promise = static_cast<fibers::promise<void>*>(data);
-    promise->set_value();
+    static_cast<completion_slot*>(data)->complete(0);
 }
 
 }
 
 void close_handle(uv_handle_t* handle)
 {
-    fibers::promise<void> promise;
+    completion_slot slot;
 
     if (DEBUG_LOG) std::cout << "closing handle\n";
-    uv_handle_set_data(handle, &promise);
+    uv_handle_set_data(handle, &slot);
     uv_close(handle, on_handle_closed);
 
-    promise.get_future().get();
+    slot.wait();
 }
 
 void check_uv_status(int status) {
@@ -46,4 +45,20 @@ void check_uv_status(int status) {
     }
 }
 
+void throw_if_error(const std::error_code& ec) {
+    if (!ec) return;
+    if (DEBUG_LOG) std::cout << "throwing error code: " << ec.message() <<
+        "\n";
+    const int status = ec.value();
+    if (status == UV_ENOTCONN || status == UV_EBADF) {
+        throw socket_closed_error{};
+    } else if (status == UV_ETIMEDOUT) {
+        throw timeout_error{};
+    } else if (status == UV_EAI_ADDRFAMILY) {
+        throw address_family_not_supported_error{};
+    } else {
+        throw io_error{ ec.message().c_str() };
+    }
+}
+
 }
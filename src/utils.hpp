@@ -1,8 +1,11 @@
 #ifndef _FIBERIO_SRC_UTILS_H_
 #define _FIBERIO_SRC_UTILS_H_
 
+#include <chrono>
 #include <stdexcept>
+#include <system_error>
 #include <uv.h>
+#include <fiberio/error.hpp>
 #include <fiberio/exceptions.hpp>
 #include <boost/fiber/all.hpp>
 
@@ -28,6 +31,84 @@ public:
     void unlock() {}
 };
 
+using deadline = std::chrono::steady_clock::time_point;
+
+//! The deadline of operations that wait for as long as it takes
+constexpr deadline NO_DEADLINE = deadline::max();
+
+/*! \brief Waits on cond like cond.wait(lock), but not past the deadline
+ *
+ * Returns false if the deadline passed. Waiting with a deadline goes through
+ * the scheduler's loop timer, so it costs no extra fiber.
+ */
+inline bool wait_until(boost::fibers::condition_variable_any& cond,
+    dummy_lock& lock, const deadline& until)
+{
+    if (until == NO_DEADLINE) {
+        cond.wait(lock);
+        return true;
+    }
+    return cond.wait_until(lock, until) == boost::fibers::cv_status::no_timeout;
+}
+
+/*! \brief Where a libuv callback leaves the result of one operation
+ *
+ * This replaces fibers::promise<void> for operations whose callback runs on
+ * the loop of the waiting fiber. It holds a status, a flag and a fiber
+ * condition variable to park the waiting fiber on, with no heap-allocated
+ * shared state or exception_ptr. It usually lives on the waiting fiber's
+ * stack, pointed to by the request.
+ */
+class completion_slot
+{
+public:
+    completion_slot() : status_{0}, done_{false} {}
+
+    completion_slot(const completion_slot&) = delete;
+    completion_slot& operator=(const completion_slot&) = delete;
+
+    //! Stores the status of the operation and wakes the waiting fiber
+    void complete(int status) {
+        status_ = status;
+        done_ = true;
+        cond_.notify_one();
+    }
+
+    //! Waits for complete() and returns the status
+    int wait() {
+        dummy_lock lock;
+        while (!done_) {
+            cond_.wait(lock);
+        }
+        return status_;
+    }
+
+    //! Waits like wait() but returns false if the deadline passed first
+    bool wait_until(const deadline& until) {
+        dummy_lock lock;
+        while (!done_) {
+            if (!fiberio::wait_until(cond_, lock, until)) return done_;
+        }
+        return true;
+    }
+
+    //! The status, once wait() or wait_until() returned true
+    int get_status() const { return status_; }
+
+private:
+    boost::fibers::condition_variable_any cond_;
+    int status_;
+    bool done_;
+};
+
+//! Callback for requests whose data points to a completion_slot
+template<class Request>
+void complete_request(Request* req, int status)
+{
+    void* data = uv_req_get_data((uv_req_t*) req);
+    static_cast<completion_slot*>(data)->complete(status);
+}
+
 void close_handle(uv_handle_t* handle);
 
 inline void close_handle(uv_tcp_t* handle) {
@@ -40,6 +121,18 @@ inline void close_handle(uv_timer_t* handle) {
 
 void check_uv_status(int status);
 
+//! Wraps a libuv status in an std::error_code of io_category()
+inline std::error_code make_io_error_code(int status) {
+    return std::error_code{ status, io_category() };
+}
+
+/*! \brief Throws the exception that the throwing overloads report ec with
+ *
+ * Does nothing if ec is clear. Closed sockets, timeouts and unsupported
+ * address families get their own exception types and the rest are io_error.
+ */
+void throw_if_error(const std::error_code& ec);
+
 }
 
 #endif
@@ -0,0 +1,331 @@
+#include "work_stealing_scheduler.hpp"
+#include "loop.hpp"
+#include <fiberio/exceptions.hpp>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace fibers = boost::fibers;
+namespace this_fiber = boost::this_fiber;
+
+namespace fiberio {
+
+namespace {
+
+const bool DEBUG_LOG = false;
+
+thread_local bool work_stealing_active = false;
+
+}
+
+//! The part of a worker thread's state that other threads may touch
+class worker_slot
+{
+public:
+    worker_slot()
+        : idle_{false}, suspender_{nullptr}, left_{false}
+    {}
+
+    void set_suspender(loop_suspender* suspender) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        suspender_ = suspender;
+    }
+
+    void notify() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        if (suspender_) suspender_->notify();
+    }
+
+    void push_stealable(fibers::context* fiber) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        stealable_.push_back(fiber);
+    }
+
+    //! Returns false if the thread has left and won't run the fiber
+    bool push_incoming(fibers::context* fiber) {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        if (left_) return false;
+        incoming_.push_back(fiber);
+        return true;
+    }
+
+    /*! \brief Marks the thread as gone and returns the fibers sent to it
+     *
+     * Fibers that are stealable stay here for the other threads to steal.
+     */
+    std::deque<fibers::context*> leave() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        left_ = true;
+        suspender_ = nullptr;
+        return std::move(incoming_);
+    }
+
+    fibers::context* pop_incoming() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return pop_front(incoming_);
+    }
+
+    fibers::context* pop_stealable() {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return pop_front(stealable_);
+    }
+
+    bool has_work() const {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        return !incoming_.empty() || !stealable_.empty();
+    }
+
+    bool is_idle() const { return idle_.load(); }
+
+    void set_idle(bool idle) { idle_.store(idle); }
+
+private:
+    static fibers::context* pop_front(std::deque<fibers::context*>& queue) {
+        if (queue.empty()) return nullptr;
+        fibers::context* fiber = queue.front();
+        queue.pop_front();
+        return fiber;
+    }
+
+    mutable std::mutex mutex_;
+    // Fibers that any thread may run
+    std::deque<fibers::context*> stealable_;
+    // Fibers that were bound to this thread while running somewhere else
+    std::deque<fibers::context*> incoming_;
+    std::atomic<bool> idle_;
+    loop_suspender* suspender_;
+    bool left_;
+};
+
+//! The threads that share fibers with each other
+class worker_group
+{
+public:
+    worker_group(std::uint32_t size)
+        : joined_{0}, stealable_{0}, idle_{0}
+    {
+        for (std::uint32_t i = 0; i < size; i++) {
+            slots_.push_back(std::make_unique<worker_slot>());
+        }
+    }
+
+    bool is_full() const { return joined_ == slots_.size(); }
+
+    std::uint32_t size() const { return slots_.size(); }
+
+    std::uint32_t join() { return joined_++; }
+
+    worker_slot* get_slot(std::uint32_t index) { return slots_[index].get(); }
+
+    bool has_stealable() const { return stealable_.load() > 0; }
+
+    void on_pushed_stealable(worker_slot* from) {
+        stealable_.fetch_add(1);
+        if (idle_.load() == 0) return;
+        for (auto& slot : slots_) {
+            if (slot.get() != from && slot->is_idle()) {
+                if (DEBUG_LOG) std::cout << "waking up idle worker\n";
+                slot->notify();
+                return;
+            }
+        }
+    }
+
+    void on_popped_stealable() { stealable_.fetch_sub(1); }
+
+    void enter_idle(worker_slot* slot) {
+        slot->set_idle(true);
+        idle_.fetch_add(1);
+    }
+
+    void exit_idle(worker_slot* slot) {
+        idle_.fetch_sub(1);
+        slot->set_idle(false);
+    }
+
+private:
+    std::vector<std::unique_ptr<worker_slot>> slots_;
+    std::uint32_t joined_;
+    std::atomic<std::size_t> stealable_;
+    std::atomic<std::uint32_t> idle_;
+};
+
+namespace {
+
+std::mutex forming_group_mutex;
+std::shared_ptr<worker_group> forming_group;
+
+std::shared_ptr<worker_group> join_group(std::uint32_t thread_count,
+    std::uint32_t& index)
+{
+    std::lock_guard<std::mutex> lock{ forming_group_mutex };
+    if (!forming_group || forming_group->size() != thread_count) {
+        if (DEBUG_LOG) std::cout << "creating group of " << thread_count <<
+            " threads\n";
+        forming_group = std::make_shared<worker_group>(thread_count);
+    }
+    auto group = forming_group;
+    index = group->join();
+    if (group->is_full()) {
+        forming_group.reset();
+    }
+    return group;
+}
+
+}
+
+work_stealing_scheduler::work_stealing_scheduler(std::uint32_t thread_count)
+    : index_{0}, prefer_shared_{false}
+{
+    if (DEBUG_LOG) std::cout << "creating work_stealing_scheduler\n";
+    group_ = join_group(std::max<std::uint32_t>(1, thread_count), index_);
+    slot_ = group_->get_slot(index_);
+    slot_->set_suspender(&suspender_);
+    uv_loop_set_data(suspender_.get_loop(), slot_);
+    work_stealing_active = true;
+}
+
+work_stealing_scheduler::~work_stealing_scheduler()
+{
+    if (DEBUG_LOG) std::cout << "destroying work_stealing_scheduler\n";
+    work_stealing_active = false;
+    uv_loop_set_data(suspender_.get_loop(), nullptr);
+    // Fibers that were on their way here would never run otherwise. Their
+    // loop is gone with this thread, so they may just as well run anywhere.
+    for (fibers::context* fiber : slot_->leave()) {
+        if (DEBUG_LOG) std::cout << "releasing fiber of exiting thread\n";
+        make_stealable(fiber);
+    }
+}
+
+void work_stealing_scheduler::awakened(fibers::context* fiber,
+    loop_affinity& props) noexcept
+{
+    worker_slot* home = props.get_home();
+    if (fiber->is_context(fibers::type::pinned_context) || home == slot_) {
+        queue_.push_back(fiber);
+    } else if (home) {
+        if (DEBUG_LOG) std::cout << "sending fiber to its home thread\n";
+        fiber->detach();
+        if (home->push_incoming(fiber)) {
+            home->notify();
+        } else {
+            make_stealable(fiber);
+        }
+    } else {
+        fiber->detach();
+        slot_->push_stealable(fiber);
+        group_->on_pushed_stealable(slot_);
+    }
+}
+
+void work_stealing_scheduler::make_stealable(fibers::context* fiber)
+{
+    auto props = static_cast<loop_affinity*>(fiber->get_properties());
+    if (props) props->set_home(nullptr);
+    slot_->push_stealable(fiber);
+    group_->on_pushed_stealable(slot_);
+}
+
+fibers::context* work_stealing_scheduler::pick_next() noexcept
+{
+    // Alternate between the queues so that neither can starve the other
+    fibers::context* fiber = nullptr;
+    prefer_shared_ = !prefer_shared_;
+    if (prefer_shared_) {
+        fiber = pick_shared();
+        if (!fiber) fiber = pick_local();
+    } else {
+        fiber = pick_local();
+        if (!fiber) fiber = pick_shared();
+    }
+    if (!fiber) fiber = steal();
+    return fiber;
+}
+
+fibers::context* work_stealing_scheduler::pick_local()
+{
+    if (queue_.empty()) return nullptr;
+    fibers::context* fiber = queue_.front();
+    queue_.pop_front();
+    return fiber;
+}
+
+fibers::context* work_stealing_scheduler::pick_shared()
+{
+    fibers::context* fiber = slot_->pop_incoming();
+    if (!fiber) {
+        fiber = slot_->pop_stealable();
+        if (fiber) group_->on_popped_stealable();
+    }
+    if (fiber) fibers::context::active()->attach(fiber);
+    return fiber;
+}
+
+fibers::context* work_stealing_scheduler::steal()
+{
+    if (!group_->has_stealable()) return nullptr;
+    const std::uint32_t size = group_->size();
+    // Start with the next thread, so that threads don't all pick the same one
+    for (std::uint32_t i = 1; i < size; i++) {
+        worker_slot* victim = group_->get_slot((index_ + i) % size);
+        fibers::context* fiber = victim->pop_stealable();
+        if (fiber) {
+            if (DEBUG_LOG) std::cout << "stole a fiber\n";
+            group_->on_popped_stealable();
+            fibers::context::active()->attach(fiber);
+            return fiber;
+        }
+    }
+    return nullptr;
+}
+
+bool work_stealing_scheduler::has_ready_fibers() const noexcept
+{
+    return !queue_.empty() || slot_->has_work();
+}
+
+void work_stealing_scheduler::suspend_until(
+    const std::chrono::steady_clock::time_point& abs_time) noexcept
+{
+    if (DEBUG_LOG) std::cout << "work_stealing_scheduler::suspend_until()\n";
+    group_->enter_idle(slot_);
+    // Check again after going idle, since nobody would wake us up for fibers
+    // that were made stealable just before that
+    if (!group_->has_stealable()) {
+        suspender_.suspend_until(abs_time, [this]() {
+            return has_ready_fibers() || group_->has_stealable();
+        });
+    }
+    group_->exit_idle(slot_);
+}
+
+void work_stealing_scheduler::notify() noexcept
+{
+    if (DEBUG_LOG) std::cout << "work_stealing_scheduler::notify()\n";
+    suspender_.notify();
+}
+
+void bind_this_fiber_to_loop(uv_loop_t* loop)
+{
+    if (work_stealing_active) {
+        auto props = static_cast<loop_affinity*>(
+            fibers::context::active()->get_properties());
+        auto home = static_cast<worker_slot*>(uv_loop_get_data(loop));
+        if (props && home && props->get_home() != home) {
+            props->set_home(home);
+            if (loop != get_uv_loop()) {
+                if (DEBUG_LOG) std::cout << "migrating fiber to its loop\n";
+                // Yielding makes awakened() hand the fiber over to its home
+                this_fiber::yield();
+            }
+        }
+    }
+    if (loop != get_uv_loop()) {
+        throw io_error{"socket belongs to another thread"};
+    }
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef _FIBERIO_SRC_WORK_STEALING_SCHEDULER_H_
+#define _FIBERIO_SRC_WORK_STEALING_SCHEDULER_H_
+
+#include "scheduler.hpp"
+#include <boost/fiber/all.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <uv.h>
+
+namespace fiberio {
+
+class worker_slot;
+class worker_group;
+
+//! Remembers which thread's loop a fiber has to run on (if any)
+class loop_affinity : public boost::fibers::fiber_properties
+{
+public:
+    loop_affinity(boost::fibers::context* ctx)
+        : fiber_properties{ ctx }, home_{ nullptr } {}
+
+    worker_slot* get_home() const { return home_; }
+
+    void set_home(worker_slot* home) { home_ = home; }
+
+private:
+    worker_slot* home_;
+};
+
+/*! \brief Scheduler that shares ready fibers between several threads
+ *
+ * Each thread still runs its own uv loop. Fibers that haven't touched a socket
+ * can be stolen by idle threads. Fibers that have are bound to the thread
+ * whose loop owns the socket and are only ever run there.
+ */
+class work_stealing_scheduler :
+    public boost::fibers::algo::algorithm_with_properties<loop_affinity>
+{
+public:
+    work_stealing_scheduler(std::uint32_t thread_count);
+
+    ~work_stealing_scheduler();
+
+    void awakened(boost::fibers::context* fiber,
+        loop_affinity& props) noexcept;
+
+    boost::fibers::context* pick_next() noexcept;
+
+    bool has_ready_fibers() const noexcept;
+
+    void suspend_until(
+        std::chrono::steady_clock::time_point const& abs_time) noexcept;
+
+    void notify() noexcept;
+
+    // Non-copyable and non-movable
+    work_stealing_scheduler(const work_stealing_scheduler&) = delete;
+    work_stealing_scheduler& operator=(
+        const work_stealing_scheduler&) = delete;
+    work_stealing_scheduler(work_stealing_scheduler&&) = delete;
+    work_stealing_scheduler& operator=(work_stealing_scheduler&&) = delete;
+
+private:
+    boost::fibers::context* pick_local();
+    boost::fibers::context* pick_shared();
+    boost::fibers::context* steal();
+
+    //! Hands a detached fiber that has no home (anymore) to any thread
+    void make_stealable(boost::fibers::context* fiber);
+
+    std::shared_ptr<worker_group> group_;
+    std::uint32_t index_;
+    worker_slot* slot_;
+    std::deque<boost::fibers::context*> queue_;
+    loop_suspender suspender_;
+    bool prefer_shared_;
+};
+
+/*! \brief Makes sure that the running fiber stays on the thread owning loop
+ *
+ * With the work-stealing scheduler, this migrates the fiber to that thread
+ * if it's running somewhere else. Throws if that isn't possible.
+ */
+void bind_this_fiber_to_loop(uv_loop_t* loop);
+
+}
+
+#endif
@@ -5,6 +5,10 @@
 #include <vector>
 #include <future>
 #include <thread>
+#include <mutex>
+#include <set>
+#include <atomic>
+#include <cstdint>
 
 namespace fibers = boost::fibers;
 namespace this_fiber = boost::this_fiber;
@@ -100,6 +104,31 @@ TEST(scheduling, async_lambda) {
     ASSERT_EQ(55, a);
 }
 
+TEST(scheduling, spawn_reuses_stacks) {
+    fiberio::use_on_this_thread();
+
+    auto stack_address = []() {
+        char local;
+        return reinterpret_cast<std::uintptr_t>(&local);
+    };
+    ASSERT_EQ(10, fiberio::spawn([](int a) { return a * 2; }, 5).get());
+
+    // A finished fiber's stack is handed to the next one with the same options
+    const std::uintptr_t first = fiberio::spawn(stack_address).get();
+    ASSERT_EQ(first, fiberio::spawn(stack_address).get());
+
+    fiberio::stack_options options;
+    options.size = 256 * 1024;
+    options.guard_page = false;
+    options.huge_pages = true;
+    fiberio::pooled_stack_allocator allocator{ options };
+    const std::uintptr_t large = fiberio::spawn(std::allocator_arg,
+        allocator, stack_address).get();
+    ASSERT_NE(first, large);
+    ASSERT_EQ(large, fiberio::spawn(std::allocator_arg, allocator,
+        stack_address).get());
+}
+
 TEST(scheduling, multithreaded_promise_resolution) {
     fiberio::use_on_this_thread();
 
@@ -233,3 +262,58 @@ TEST(scheduling, switch_between_multiple_threads) {
     thread1.get();
     thread2.get();
 }
+
+TEST(scheduling, work_stealing_threads) {
+    const std::uint32_t num_threads{ 4 };
+    const int num_fibers{ 100 };
+
+    fibers::promise<void> done_promise;
+    fibers::shared_future<void> done{ done_promise.get_future() };
+    std::mutex mutex;
+    std::set<std::thread::id> thread_ids;
+    const std::thread::id main_thread{ std::this_thread::get_id() };
+    std::atomic<bool> stolen{ false };
+
+    std::vector<std::future<void>> threads;
+    for (std::uint32_t t = 1; t < num_threads; t++) {
+        threads.push_back(std::async(std::launch::async, [&]() {
+            fiberio::use_work_stealing_on_this_thread(num_threads);
+            done.wait();
+        }));
+    }
+
+    fiberio::use_work_stealing_on_this_thread(num_threads);
+    std::vector<fibers::future<void>> futures;
+    for (int i = 0; i < num_fibers; i++) {
+        futures.push_back(fibers::async([&]() {
+            for (int j = 0; j < 10; j++) {
+                {
+                    std::lock_guard<std::mutex> lock{ mutex };
+                    thread_ids.insert(std::this_thread::get_id());
+                }
+                if (std::this_thread::get_id() != main_thread) stolen = true;
+                this_fiber::yield();
+            }
+        }));
+    }
+    // Block this thread without yielding, so only other threads can run the
+    // fibers
+    auto give_up = std::chrono::steady_clock::now() +
+        std::chrono::seconds{ 10 };
+    while (!stolen && std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{ 1 });
+    }
+    for (auto& future : futures) {
+        future.get();
+    }
+    done_promise.set_value();
+    for (auto& thread : threads) {
+        thread.get();
+    }
+
+    // Checked only now, so that failing doesn't leave the threads waiting
+    ASSERT_TRUE(stolen);
+    ASSERT_LE(thread_ids.size(), num_threads);
+
+    fiberio::use_on_this_thread();
+}
@@ -2,6 +2,16 @@
 #include <gtest/gtest.h>
 #include <boost/fiber/all.hpp>
 #include <utility>
+#include <future>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace fibers = boost::fibers;
 namespace this_fiber = boost::this_fiber;
@@ -168,6 +178,1200 @@ TEST(server_socket, read_strings) {
     server.close();
 }
 
+TEST(server_socket, vectored_write_and_read) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        char header[4];
+        char payload[6];
+        const fiberio::mutable_buffer bufs[] {
+            {header, sizeof(header)}, {payload, sizeof(payload)} };
+        server_client.read_exactly(bufs, 2);
+        return std::make_pair(std::string(header, sizeof(header)),
+            std::string(payload, sizeof(payload)));
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    client.write({{"test", 4}, {"", 0}, {"123", 3}});
+    const fiberio::const_buffer bufs[] { {"456", 3} };
+    client.write(bufs, 1);
+
+    auto result = server_future.get();
+    ASSERT_EQ("test", result.first);
+    ASSERT_EQ("123456", result.second);
+
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, vectored_read_fills_several_buffers) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.write("0123456789");
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    server_future.get();
+
+    char buf1[3];
+    char buf2[3];
+    char buf3[10];
+    const fiberio::mutable_buffer bufs[] {
+        {buf1, sizeof(buf1)}, {buf2, sizeof(buf2)}, {buf3, sizeof(buf3)} };
+    ASSERT_EQ(10, client.read(bufs, 3));
+    ASSERT_EQ("012", std::string(buf1, sizeof(buf1)));
+    ASSERT_EQ("345", std::string(buf2, sizeof(buf2)));
+    ASSERT_EQ("6789", std::string(buf3, 4));
+
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, large_vectored_write) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        std::string data;
+        while (server_client.is_open()) {
+            data += server_client.read_string();
+        }
+        return data;
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    // Much more than fits in the socket buffers, so it's a partial write
+    std::string a(1024*1024, 'a');
+    std::string b(1, 'b');
+    std::string c(3*1024*1024, 'c');
+    client.write({{a.data(), a.size()}, {b.data(), b.size()},
+        {c.data(), c.size()}});
+    client.close();
+
+    ASSERT_EQ(a + b + c, server_future.get());
+
+    server.close();
+}
+
+TEST(server_socket, reading_available_data_lets_other_fibers_run) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.write(std::string(1000, 'x'));
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    server_future.get();
+
+    // All the data has arrived, so none of these reads has to wait
+    bool other_fiber_ran = false;
+    auto other_fiber = fibers::async([&other_fiber_ran]() {
+        other_fiber_ran = true;
+    });
+    char buf[1];
+    for (int i = 0; i < 1000; i++) {
+        client.read_exactly(buf, sizeof(buf));
+    }
+    ASSERT_TRUE(other_fiber_ran);
+    other_fiber.get();
+
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, write_async_and_flush) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        std::string data;
+        while (server_client.is_open()) {
+            data += server_client.read_string();
+        }
+        return data;
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    // A small limit makes most of the writes wait for earlier ones
+    client.set_write_queue_limit(1000);
+    std::string expected;
+    for (int i = 0; i < 1000; i++) {
+        std::string message(i * 10, 'a' + i % 26);
+        expected += message;
+        if (i % 2 == 0) {
+            client.write_async(message.data(), message.size());
+        } else {
+            client.write_async(std::move(message));
+        }
+    }
+    client.write("end");
+    expected += "end";
+    client.flush();
+    client.close();
+
+    ASSERT_EQ(expected, server_future.get());
+
+    server.close();
+}
+
+TEST(server_socket, close_sends_queued_writes) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto read_all = [&server]() {
+        auto server_client = server.accept();
+        std::string data;
+        while (server_client.is_open()) {
+            data += server_client.read_string();
+        }
+        return data;
+    };
+    // Much more than the socket buffers, in many writes, so that most of them
+    // are still queued behind the first one
+    const std::size_t block_size{ 64 * 1024 };
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+        expected += std::string(block_size, 'a' + i % 26);
+    }
+    auto write_blocks = [&expected, block_size](fiberio::socket& socket) {
+        for (std::size_t i = 0; i < expected.size(); i += block_size) {
+            socket.write_async(expected.data() + i, block_size);
+        }
+    };
+
+    // Closed explicitly
+    auto closed_future = fibers::async(read_all);
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    write_blocks(client);
+    client.close();
+    ASSERT_EQ(expected, closed_future.get());
+
+    // Closed by destroying the last copy
+    auto destroyed_future = fibers::async(read_all);
+    {
+        fiberio::socket other;
+        other.connect(server.get_host(), server.get_port());
+        write_blocks(other);
+    }
+    ASSERT_EQ(expected, destroyed_future.get());
+
+    server.close();
+}
+
+TEST(server_socket, flush_after_reset) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+
+    // Nobody reads this, so most of it stays queued
+    client.write_async(std::string(8 * 1024 * 1024, 'a'));
+    server_client.close(fiberio::socket::close_mode::abortive);
+    ASSERT_THROW(client.flush(), fiberio::io_error);
+
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, read_slices) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.write("0123456789");
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    server_future.get();
+
+    fiberio::buffer_slice first = client.read_slice(4);
+    ASSERT_EQ("0123", std::string(first.begin(), first.end()));
+    fiberio::buffer_slice second = client.read_slice();
+    ASSERT_EQ("456789", std::string(second.data(), second.size()));
+
+    // Copies and subslices share the pooled buffer with the original
+    fiberio::buffer_slice copy = second;
+    fiberio::buffer_slice part = second.subslice(2, 3);
+    second = fiberio::buffer_slice{};
+    ASSERT_EQ("678", std::string(part.data(), part.size()));
+    ASSERT_EQ("456789", std::string(copy.data(), copy.size()));
+    ASSERT_THROW(copy.subslice(4, 3), std::out_of_range);
+
+    ASSERT_TRUE(client.read_slice().empty());
+    ASSERT_FALSE(client.is_open());
+
+    server.close();
+}
+
+TEST(server_socket, read_string_reuses_pooled_buffers) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        for (int i = 0; i < 10; i++) {
+            server_client.write("message");
+            ASSERT_EQ("ok", server_client.read_string_exactly(2));
+        }
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    const fiberio::buffer_pool_stats before = fiberio::get_buffer_pool_stats();
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ("message", client.read_string(1024));
+        client.write("ok");
+    }
+    const fiberio::buffer_pool_stats after = fiberio::get_buffer_pool_stats();
+    ASSERT_GE(after.reused - before.reused, 9u);
+    ASSERT_LE(after.allocated - before.allocated, 1u);
+    ASSERT_GT(after.cached_bytes, 0u);
+
+    server_future.get();
+    server.close();
+}
+
+TEST(server_socket, accept_many) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    std::vector<fiberio::socket> clients(5);
+    for (auto& client : clients) {
+        client.connect(server.get_host(), server.get_port());
+    }
+
+    std::vector<fiberio::socket> accepted = server.accept_many(3);
+    ASSERT_EQ(3u, accepted.size());
+    ASSERT_TRUE(server.accept_many(0).empty());
+    std::vector<fiberio::socket> rest = server.accept_many(10);
+    ASSERT_EQ(2u, rest.size());
+    for (auto& server_client : rest) {
+        accepted.push_back(std::move(server_client));
+    }
+
+    for (std::size_t i = 0; i < clients.size(); i++) {
+        clients[i].write(std::to_string(i));
+    }
+    std::vector<std::string> received;
+    for (auto& server_client : accepted) {
+        received.push_back(server_client.read_string_exactly(1));
+        server_client.close();
+    }
+    std::sort(received.begin(), received.end());
+    ASSERT_EQ((std::vector<std::string>{"0", "1", "2", "3", "4"}), received);
+
+    server.close();
+}
+
+TEST(server_socket, reuse_port) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket first;
+    first.bind("127.0.0.1", 0, true);
+    first.listen(50);
+
+    auto second_future = std::async([port = first.get_port()]() {
+        fiberio::use_on_this_thread();
+        fiberio::server_socket second;
+        second.bind("127.0.0.1", port, true);
+        second.listen(50);
+        second.close();
+    });
+    ASSERT_NO_THROW(second_future.get());
+
+    // libuv may report EADDRINUSE from either bind() or listen()
+    fiberio::server_socket without_option;
+    ASSERT_THROW({
+        without_option.bind("127.0.0.1", first.get_port());
+        without_option.listen(50);
+    }, std::exception);
+
+    fiberio::socket client;
+    client.connect(first.get_host(), first.get_port());
+    auto server_client = first.accept();
+    client.write("x");
+    ASSERT_EQ("x", server_client.read_string_exactly(1));
+
+    first.close();
+}
+
+TEST(server_socket, acceptor_hands_out_connections) {
+    fiberio::use_on_this_thread();
+    fiberio::acceptor acceptor{ fiberio::acceptor::policy::round_robin };
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    const int num_workers = 2;
+    const int num_clients = 6;
+    std::vector<std::promise<void>> joined(num_workers);
+    std::vector<std::future<std::string>> workers;
+    for (auto& promise : joined) {
+        workers.push_back(std::async(std::launch::async,
+            [&acceptor, &promise]() {
+                fiberio::use_on_this_thread();
+                acceptor.join();
+                promise.set_value();
+                std::string received;
+                while (true) {
+                    fiberio::socket client;
+                    try {
+                        client = acceptor.receive();
+                    } catch (std::runtime_error& e) {
+                        break;
+                    }
+                    received += client.read_string_exactly(1);
+                    client.write("ok");
+                    client.close();
+                }
+                return received;
+            }));
+    }
+    for (auto& promise : joined) {
+        promise.get_future().get();
+    }
+
+    auto run_future = fibers::async([&acceptor, &server]() {
+        acceptor.run(server);
+    });
+
+    for (int i = 0; i < num_clients; i++) {
+        fiberio::socket client;
+        client.connect(server.get_host(), server.get_port());
+        client.write(std::to_string(i));
+        ASSERT_EQ("ok", client.read_string_exactly(2));
+    }
+    server.close();
+    run_future.get();
+
+    std::string all;
+    for (auto& worker : workers) {
+        std::string received = worker.get();
+        ASSERT_EQ(std::size_t{ num_clients / num_workers }, received.size());
+        all += received;
+    }
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ("012345", all);
+}
+
+TEST(server_socket, acceptor_on_another_thread) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+    fiberio::acceptor acceptor;
+
+    // The server belongs to this thread, so run() fails instead of retrying
+    auto other_thread = std::async(std::launch::async, [&]() {
+        fiberio::use_on_this_thread();
+        acceptor.join();
+        acceptor.run(server);
+    });
+    ASSERT_THROW(other_thread.get(), fiberio::io_error);
+
+    server.close();
+}
+
+TEST(server_socket, migrate_socket_to_other_thread) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    client.set_streaming(true);
+    auto server_client = server.accept();
+
+    server_client.write("hello world");
+    ASSERT_EQ("hello ", client.read_string_exactly(6));
+    client.write_async("abc");
+    fiberio::detached_socket detached = client.detach();
+    ASSERT_FALSE(detached.empty());
+    ASSERT_FALSE(client.is_open());
+    server_client.write("!");
+
+    // The rest of the data was buffered before detaching and must survive
+    auto future = std::async(std::launch::async,
+        [detached = std::move(detached)]() mutable {
+            fiberio::use_on_this_thread();
+            fiberio::socket moved{ std::move(detached) };
+            std::string received = moved.read_string_exactly(6);
+            moved.write("ok");
+            moved.close();
+            return received;
+        });
+    ASSERT_EQ("world!", future.get());
+    ASSERT_EQ("abcok", server_client.read_string_exactly(5));
+
+    server_client.close();
+    server.close();
+}
+
+TEST(server_socket, idle_timeout) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.set_idle_timeout(std::chrono::milliseconds{300});
+        std::string data;
+        auto start = std::chrono::steady_clock::now();
+        while (server_client.is_open()) {
+            data += server_client.read_string();
+        }
+        return std::make_pair(data, std::chrono::steady_clock::now() - start);
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    // Activity keeps the connection open past the timeout
+    for (int i = 0; i < 6; i++) {
+        this_fiber::sleep_for(std::chrono::milliseconds{100});
+        client.write("a");
+    }
+    auto result = server_future.get();
+    ASSERT_EQ("aaaaaa", result.first);
+    ASSERT_GE(result.second, std::chrono::milliseconds{800});
+    ASSERT_LT(result.second, std::chrono::milliseconds{2000});
+
+    // The client sees the end of the stream
+    ASSERT_EQ("", client.read_string());
+    ASSERT_FALSE(client.is_open());
+
+    server.close();
+}
+
+TEST(server_socket, idle_timeout_turned_off) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+    server_client.set_idle_timeout(std::chrono::milliseconds{100});
+    server_client.set_idle_timeout(std::chrono::milliseconds{0});
+
+    this_fiber::sleep_for(std::chrono::milliseconds{300});
+    client.write("abc");
+    ASSERT_EQ("abc", server_client.read_string_exactly(3));
+
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, read_timeout) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+
+    char buf[16];
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_THROW(server_client.read(buf, sizeof(buf),
+        std::chrono::milliseconds{100}), fiberio::timeout_error);
+    ASSERT_GE(std::chrono::steady_clock::now() - start,
+        std::chrono::milliseconds{100});
+
+    // The socket is still usable after the timeout
+    ASSERT_TRUE(server_client.is_open());
+    client.write("abc");
+    ASSERT_EQ(3, server_client.read(buf, sizeof(buf),
+        std::chrono::milliseconds{1000}));
+    ASSERT_EQ("abc", std::string(buf, 3));
+
+    // The same goes for streaming reads
+    server_client.set_streaming(true);
+    ASSERT_THROW(server_client.read(buf, sizeof(buf),
+        std::chrono::milliseconds{50}), fiberio::timeout_error);
+    client.write("def");
+    server_client.read_exactly(buf, 3, std::chrono::milliseconds{1000});
+    ASSERT_EQ("def", std::string(buf, 3));
+
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, write_timeout) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+
+    // Nobody reads, so the socket buffers fill up
+    std::string data(64 * 1024 * 1024, 'a');
+    ASSERT_THROW(client.write(data.data(), data.size(),
+        std::chrono::milliseconds{100}), fiberio::timeout_error);
+    ASSERT_FALSE(client.is_open());
+
+    server_client.close();
+    server.close();
+}
+
+TEST(server_socket, accept_timeout) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    ASSERT_THROW(server.accept(std::chrono::milliseconds{50}),
+        fiberio::timeout_error);
+
+    // The server keeps listening
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port(),
+        std::chrono::milliseconds{1000});
+    auto server_client = server.accept(std::chrono::milliseconds{1000});
+    client.write("abc");
+    ASSERT_EQ("abc", server_client.read_string_exactly(3));
+
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+//! Connects a plain socket, which the test can reset, to the server
+int connect_raw(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! Closes fd with an RST instead of a FIN
+void reset_raw(int fd) {
+    struct linger lin{ 1, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    ::close(fd);
+}
+
+TEST(server_socket, error_code_overloads) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    std::error_code ec;
+    server.accept(std::chrono::steady_clock::now() +
+        std::chrono::milliseconds{50}, ec);
+    ASSERT_TRUE(ec == std::errc::timed_out);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port(), ec);
+    ASSERT_FALSE(ec);
+    auto server_client = server.accept(ec);
+    ASSERT_FALSE(ec);
+    client.write("abc", 3, ec);
+    ASSERT_FALSE(ec);
+    char buf[16];
+    ASSERT_EQ(3, server_client.read(buf, sizeof(buf), ec));
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(0, server_client.read(buf, sizeof(buf),
+        std::chrono::steady_clock::now() + std::chrono::milliseconds{50}, ec));
+    ASSERT_TRUE(ec == std::errc::timed_out);
+    ASSERT_TRUE(server_client.is_open());
+
+    // The end of the stream isn't an error, but reading after it is
+    client.close();
+    ASSERT_EQ(0, server_client.read(buf, sizeof(buf), ec));
+    ASSERT_FALSE(ec);
+    server_client.read(buf, sizeof(buf), ec);
+    ASSERT_TRUE(ec == std::errc::not_connected);
+    server_client.write("abc", 3, ec);
+    ASSERT_TRUE(ec == std::errc::not_connected);
+
+    int fd = connect_raw(server.get_port());
+    ASSERT_GE(fd, 0);
+    auto reset_client = server.accept(ec);
+    ASSERT_FALSE(ec);
+    reset_raw(fd);
+    reset_client.read(buf, sizeof(buf), ec);
+    ASSERT_TRUE(ec == std::errc::connection_reset);
+    ASSERT_EQ(fiberio::io_category(), ec.category());
+    reset_client.close();
+
+    fiberio::server_socket closed_server;
+    closed_server.bind("127.0.0.1", 0);
+    const uint16_t closed_port = closed_server.get_port();
+    closed_server.close();
+    fiberio::socket refused;
+    refused.connect("127.0.0.1", closed_port, ec);
+    ASSERT_TRUE(ec == std::errc::connection_refused);
+
+    fibers::fiber closer{ [&]() { server.close(); } };
+    server.accept(ec);
+    ASSERT_TRUE(ec == std::errc::operation_canceled);
+    closer.join();
+}
+
+TEST(server_socket, error_code_read_after_fin_and_reset) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    for (bool streaming : { false, true }) {
+        int peer = connect_raw(server.get_port());
+        ASSERT_GE(peer, 0);
+        auto server_client = server.accept();
+        server_client.set_streaming(streaming);
+        // The close at the end of the stream has queued data to send
+        server_client.write_async(std::string(1024 * 1024, 'a'));
+        ASSERT_EQ(1, ::write(peer, "x", 1));
+        ::shutdown(peer, SHUT_WR);
+        this_fiber::sleep_for(std::chrono::milliseconds{ 10 });
+        reset_raw(peer);
+        this_fiber::sleep_for(std::chrono::milliseconds{ 10 });
+
+        std::error_code ec;
+        char buf[16];
+        std::size_t bytes_read = 0;
+        do {
+            ASSERT_NO_THROW(bytes_read =
+                server_client.read(buf, sizeof(buf), ec));
+        } while (bytes_read > 0 && !ec);
+        ASSERT_FALSE(server_client.is_open());
+    }
+
+    server.close();
+}
+
+TEST(server_socket, close_modes) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    // Queued data is still sent after a background close
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+    const std::string data(4 * 1024 * 1024, 'x');
+    client.set_write_queue_limit(data.size());
+    client.write_async(std::string{ data });
+    client.close(fiberio::socket::close_mode::background);
+    ASSERT_FALSE(client.is_open());
+    ASSERT_EQ(data, server_client.read_string_exactly(data.size()));
+    char buf[16];
+    ASSERT_EQ(0, server_client.read(buf, sizeof(buf)));
+
+    // An abortive close resets the connection
+    fiberio::socket reset_client;
+    reset_client.connect(server.get_host(), server.get_port());
+    server_client = server.accept();
+    reset_client.close(fiberio::socket::close_mode::abortive);
+    ASSERT_FALSE(reset_client.is_open());
+    std::error_code ec;
+    server_client.read(buf, sizeof(buf), ec);
+    ASSERT_TRUE(ec == std::errc::connection_reset);
+    server_client.close();
+
+    // Dropping an open socket closes it in the chosen way
+    {
+        fiberio::socket dropped;
+        dropped.connect(server.get_host(), server.get_port());
+        dropped.set_close_mode_on_destroy(
+            fiberio::socket::close_mode::background);
+        server_client = server.accept();
+    }
+    ASSERT_EQ(0, server_client.read(buf, sizeof(buf)));
+
+    server.close();
+}
+
+int get_int_option(int fd, int level, int name) {
+    int value = -1;
+    socklen_t len = sizeof(value);
+    ::getsockopt(fd, level, name, &value, &len);
+    return value;
+}
+
+TEST(server_socket, tcp_options) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    fiberio::tcp_options accepted_options;
+    accepted_options.no_delay = true;
+    accepted_options.keepalive_idle = std::chrono::seconds{ 42 };
+    accepted_options.quick_ack = true;
+    // Set before bind(), so it's applied by bind()
+    server.set_accepted_options(accepted_options);
+    fiberio::listen_options listen_options;
+    listen_options.fast_open_queue = 16;
+    server.bind("127.0.0.1", 0);
+    server.set_listen_options(listen_options);
+    server.listen(50);
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    fiberio::tcp_options client_options;
+    client_options.no_delay = true;
+    client_options.receive_buffer_size = 64 * 1024;
+    client.set_options(client_options);
+    auto server_client = server.accept();
+
+    // The options are read through the descriptors of detached connections
+    auto detached_client = client.detach();
+    int client_fd = detached_client.native_handle();
+    ASSERT_GE(client_fd, 0);
+    ASSERT_EQ(1, get_int_option(client_fd, IPPROTO_TCP, TCP_NODELAY));
+    ASSERT_GE(get_int_option(client_fd, SOL_SOCKET, SO_RCVBUF), 64 * 1024);
+    client = fiberio::socket(std::move(detached_client));
+
+    auto check_accepted = [](fiberio::socket& accepted) {
+        auto detached = accepted.detach();
+        int fd = detached.native_handle();
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(1, get_int_option(fd, IPPROTO_TCP, TCP_NODELAY));
+        ASSERT_EQ(1, get_int_option(fd, IPPROTO_TCP, TCP_QUICKACK));
+        ASSERT_EQ(1, get_int_option(fd, SOL_SOCKET, SO_KEEPALIVE));
+        ASSERT_EQ(42, get_int_option(fd, IPPROTO_TCP, TCP_KEEPIDLE));
+        accepted = fiberio::socket(std::move(detached));
+    };
+    check_accepted(server_client);
+
+    // Options the system rejects are reported and not kept
+    fiberio::tcp_options invalid;
+    invalid.keepalive_idle = std::chrono::seconds{ 1000000 };
+    ASSERT_THROW(client.set_options(invalid), fiberio::io_error);
+    ASSERT_THROW(server.set_accepted_options(invalid), fiberio::io_error);
+
+    fiberio::socket second_client;
+    second_client.connect(server.get_host(), server.get_port());
+    auto second_server_client = server.accept();
+    check_accepted(second_server_client);
+    second_server_client.close();
+    second_client.close();
+
+    client.write("abc");
+    ASSERT_EQ("abc", server_client.read_string_exactly(3));
+
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, send_file) {
+    fiberio::use_on_this_thread();
+    // Bigger than the socket buffers, so sending has to wait for the reader
+    std::string contents(4 * 1024 * 1024, 0);
+    for (std::size_t i = 0; i < contents.size(); i++) {
+        contents[i] = 'a' + i % 23;
+    }
+    char path[] = "/tmp/fiberio_send_file_XXXXXX";
+    int file_fd = mkstemp(path);
+    ASSERT_GE(file_fd, 0);
+    ASSERT_EQ(static_cast<ssize_t>(contents.size()),
+        ::write(file_fd, contents.data(), contents.size()));
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    auto server_client = server.accept();
+
+    auto sender = fibers::async([&]() {
+        server_client.write_async("first");
+        server_client.send_file(file_fd);
+        server_client.send_file(path, 1000, 5000);
+        // The range goes past the end of the file
+        ASSERT_THROW(server_client.send_file(file_fd, contents.size() - 10,
+            20), fiberio::io_error);
+    });
+    ASSERT_EQ("first", client.read_string_exactly(5));
+    ASSERT_EQ(contents, client.read_string_exactly(contents.size()));
+    ASSERT_EQ(contents.substr(1000, 5000), client.read_string_exactly(5000));
+    // What there was of the range was sent before the error
+    ASSERT_EQ(contents.substr(contents.size() - 10),
+        client.read_string_exactly(10));
+    sender.get();
+
+    // A write() that libuv is still busy with goes out before the file
+    const std::string written(8 * 1024 * 1024, 'w');
+    auto writer = fibers::async([&]() {
+        server_client.write(written);
+    });
+    this_fiber::yield();
+    auto file_sender = fibers::async([&]() {
+        server_client.send_file(file_fd);
+    });
+    ASSERT_EQ(written, client.read_string_exactly(written.size()));
+    ASSERT_EQ(contents, client.read_string_exactly(contents.size()));
+    writer.get();
+    file_sender.get();
+
+    ASSERT_EQ(0u, server_client.send_file(file_fd, contents.size()));
+    ASSERT_THROW(server_client.send_file("/nonexistent/fiberio"),
+        fiberio::io_error);
+
+    ::close(file_fd);
+    ::unlink(path);
+    server_client.close();
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, dns_cache) {
+    fiberio::use_on_this_thread();
+    fiberio::clear_dns_cache();
+    fiberio::server_socket server;
+    server.bind("localhost", 0);
+    server.listen(50);
+
+    auto before = fiberio::get_dns_cache_stats();
+    std::vector<fibers::future<void>> clients;
+    for (int i = 0; i < 4; i++) {
+        clients.push_back(fibers::async([&server]() {
+            fiberio::socket client;
+            client.connect("localhost", server.get_port());
+            client.close();
+        }));
+    }
+    for (int i = 0; i < 4; i++) {
+        server.accept().close();
+    }
+    for (auto& client : clients) {
+        client.get();
+    }
+
+    // Only the first fiber asked the resolver and the others waited for it
+    auto after = fiberio::get_dns_cache_stats();
+    ASSERT_EQ(before.misses + 1, after.misses);
+    ASSERT_EQ(before.coalesced + 3, after.coalesced);
+
+    fiberio::socket client;
+    client.connect("localhost", server.get_port());
+    ASSERT_EQ(after.hits + 1, fiberio::get_dns_cache_stats().hits);
+    client.close();
+    server.accept().close();
+
+    // Expired entries are looked up again
+    auto options = fiberio::get_dns_cache_options();
+    auto short_options = options;
+    short_options.ttl = std::chrono::milliseconds{1};
+    fiberio::set_dns_cache_options(short_options);
+    fiberio::clear_dns_cache();
+    client = fiberio::socket{};
+    client.connect("localhost", server.get_port());
+    client.close();
+    server.accept().close();
+    this_fiber::sleep_for(std::chrono::milliseconds{10});
+    client = fiberio::socket{};
+    client.connect("localhost", server.get_port());
+    client.close();
+    server.accept().close();
+    ASSERT_EQ(after.misses + 2, fiberio::get_dns_cache_stats().misses);
+    fiberio::set_dns_cache_options(options);
+
+    server.close();
+}
+
+TEST(server_socket, numeric_address_skips_resolver) {
+    fiberio::use_on_this_thread();
+    auto before = fiberio::get_dns_cache_stats();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+    fiberio::socket client;
+    client.connect("127.0.0.1", server.get_port());
+    server.accept().close();
+    client.close();
+
+    auto after = fiberio::get_dns_cache_stats();
+    ASSERT_EQ(before.misses, after.misses);
+    ASSERT_EQ(before.hits, after.hits);
+    ASSERT_EQ(before.coalesced, after.coalesced);
+
+    server.close();
+}
+
+TEST(server_socket, dns_cache_negative) {
+    fiberio::use_on_this_thread();
+    fiberio::clear_dns_cache();
+
+    auto before = fiberio::get_dns_cache_stats();
+    fiberio::socket client;
+    ASSERT_THROW(client.connect("nonexistent.invalid", 80), fiberio::io_error);
+    fiberio::socket client2;
+    ASSERT_THROW(client2.connect("nonexistent.invalid", 80), fiberio::io_error);
+    auto after = fiberio::get_dns_cache_stats();
+    ASSERT_EQ(before.misses + 1, after.misses);
+    ASSERT_EQ(before.negative_hits + 1, after.negative_hits);
+}
+
+//! Finds a name with both loopback addresses and the family listed first
+std::pair<std::string, int> find_dual_stack_loopback_name() {
+    for (const char* name : { "localhost", "ip6-localhost", "localhost6" }) {
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* result;
+        if (::getaddrinfo(name, nullptr, &hints, &result) != 0) continue;
+        bool ipv4 = false;
+        bool ipv6 = false;
+        for (auto addr = result; addr; addr = addr->ai_next) {
+            if (addr->ai_family == AF_INET) ipv4 = true;
+            if (addr->ai_family == AF_INET6) ipv6 = true;
+        }
+        int first_family = result->ai_family;
+        ::freeaddrinfo(result);
+        if (ipv4 && ipv6) return std::make_pair(name, first_family);
+    }
+    return std::make_pair("", AF_UNSPEC);
+}
+
+//! Listens on the loopback address of family with a full backlog
+int listen_without_answering(int family, uint16_t port) {
+    struct sockaddr_storage addr;
+    std::memset(&addr, 0, sizeof(addr));
+    socklen_t addr_length;
+    if (family == AF_INET6) {
+        auto addr6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_addr = in6addr_loopback;
+        addr6->sin6_port = htons(port);
+        addr_length = sizeof(*addr6);
+    } else {
+        auto addr4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr4->sin_port = htons(port);
+        addr_length = sizeof(*addr4);
+    }
+    int fd = ::socket(family, SOCK_STREAM, 0);
+    EXPECT_EQ(0, ::bind(fd, (struct sockaddr*) &addr, addr_length));
+    EXPECT_EQ(0, ::listen(fd, 0));
+    // Once one connection waits to be accepted, further SYNs are dropped
+    int filler = ::socket(family, SOCK_STREAM, 0);
+    EXPECT_EQ(0, ::connect(filler, (struct sockaddr*) &addr, addr_length));
+    ::close(filler);
+    return fd;
+}
+
+TEST(server_socket, connect_races_addresses) {
+    fiberio::use_on_this_thread();
+    auto name = find_dual_stack_loopback_name();
+    if (name.first.empty()) {
+        GTEST_SKIP() << "no name with both an IPv4 and IPv6 loopback address";
+    }
+
+    // The family that getaddrinfo() lists first doesn't answer
+    fiberio::server_socket server;
+    server.bind(name.second == AF_INET6 ? "127.0.0.1" : "::1", 0);
+    server.listen(50);
+    int blackhole = listen_without_answering(name.second, server.get_port());
+
+    fiberio::clear_dns_cache();
+    auto start = std::chrono::steady_clock::now();
+    fiberio::socket client;
+    client.connect(name.first, server.get_port());
+    ASSERT_LT(std::chrono::steady_clock::now() - start,
+        std::chrono::milliseconds{1000});
+    auto server_client = server.accept();
+    client.write("abc");
+    ASSERT_EQ("abc", server_client.read_string_exactly(3));
+    server_client.close();
+    client.close();
+    ::close(blackhole);
+
+    // When every address refuses, the error is reported
+    uint16_t port = server.get_port();
+    server.close();
+    fiberio::socket refused;
+    ASSERT_THROW(refused.connect(name.first, port), fiberio::io_error);
+}
+
+TEST(server_socket, connection_pool_reuses_connections) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    // Echoes every byte on each connection and counts the connections
+    int accepted = 0;
+    auto server_future = fibers::async([&server, &accepted]() {
+        std::vector<fibers::future<void>> clients;
+        try {
+            while (true) {
+                auto server_client = server.accept();
+                accepted++;
+                clients.push_back(fibers::async([server_client]() mutable {
+                    while (server_client.is_open()) {
+                        auto data = server_client.read_string();
+                        if (!data.empty()) server_client.write(data);
+                    }
+                }));
+            }
+        } catch (std::runtime_error& e) {
+            // The server was closed
+        }
+        for (auto& client : clients) client.get();
+    });
+
+    fiberio::connection_pool pool;
+    for (int i = 0; i < 5; i++) {
+        auto connection = pool.acquire("127.0.0.1", server.get_port());
+        connection->write("a");
+        ASSERT_EQ("a", connection->read_string_exactly(1));
+        connection.release();
+    }
+    ASSERT_EQ(1, accepted);
+    auto stats = pool.get_stats();
+    ASSERT_EQ(1, stats.connected);
+    ASSERT_EQ(4, stats.reused);
+    ASSERT_EQ(1, stats.idle);
+
+    // A connection that isn't released is closed instead
+    {
+        auto connection = pool.acquire("127.0.0.1", server.get_port());
+        connection->write("a");
+    }
+    ASSERT_EQ(0, pool.get_stats().idle);
+    auto connection = pool.acquire("127.0.0.1", server.get_port());
+    ASSERT_EQ(2, accepted);
+    connection.release();
+
+    pool.clear();
+    server.close();
+    server_future.get();
+}
+
+TEST(server_socket, connection_pool_limits_connections) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::connection_pool_options options;
+    options.max_connections = 2;
+    fiberio::connection_pool pool{ options };
+
+    std::vector<fiberio::socket> server_clients;
+    auto server_future = fibers::async([&server, &server_clients]() {
+        for (int i = 0; i < 2; i++) {
+            server_clients.push_back(server.accept());
+        }
+    });
+
+    // Five fibers share two connections
+    int in_use = 0;
+    int max_in_use = 0;
+    std::vector<fibers::future<void>> users;
+    for (int i = 0; i < 5; i++) {
+        users.push_back(fibers::async([&]() {
+            auto connection = pool.acquire("127.0.0.1", server.get_port());
+            max_in_use = std::max(max_in_use, ++in_use);
+            this_fiber::sleep_for(std::chrono::milliseconds{10});
+            in_use--;
+            connection.release();
+        }));
+    }
+    for (auto& user : users) user.get();
+    server_future.get();
+
+    ASSERT_EQ(2, max_in_use);
+    auto stats = pool.get_stats();
+    ASSERT_EQ(2, stats.connected);
+    ASSERT_EQ(3, stats.reused);
+    ASSERT_GE(stats.waited, 3);
+
+    for (auto& server_client : server_clients) server_client.close();
+    server.close();
+}
+
+TEST(server_socket, connection_pool_drops_dead_connections) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    fiberio::connection_pool pool;
+    auto connection = pool.acquire("127.0.0.1", server.get_port());
+    auto server_client = server.accept();
+    connection.release();
+
+    // The peer closes the idle connection, so a new one is opened
+    server_client.close();
+    this_fiber::sleep_for(std::chrono::milliseconds{10});
+    connection = pool.acquire("127.0.0.1", server.get_port());
+    server_client = server.accept();
+    connection->write("abc");
+    ASSERT_EQ("abc", server_client.read_string_exactly(3));
+    auto stats = pool.get_stats();
+    ASSERT_EQ(1, stats.dead);
+    ASSERT_EQ(2, stats.connected);
+
+    connection.release();
+    pool.clear();
+    server_client.close();
+    server.close();
+}
+
 TEST(server_socket, closed_socket) {
     fiberio::use_on_this_thread();
     fiberio::socket client;
@@ -178,6 +1382,9 @@ TEST(server_socket, closed_socket) {
     ASSERT_THROW(client.read_string(), fiberio::socket_closed_error);
     ASSERT_THROW(client.read_string(), fiberio::socket_closed_error);
     ASSERT_THROW(client.write("test"), fiberio::socket_closed_error);
+    ASSERT_THROW(client.write_async("test", 4), fiberio::socket_closed_error);
+    ASSERT_THROW(client.flush(), fiberio::socket_closed_error);
+    ASSERT_THROW(client.detach(), fiberio::socket_closed_error);
     ASSERT_THROW(client.connect("127.0.0.1", 1000),
         fiberio::socket_closed_error);
 }
@@ -378,6 +1585,114 @@ TEST(server_socket, partial_string_read) {
     server.close();
 }
 
+TEST(server_socket, streaming_read_exactly) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.set_streaming(true);
+        auto s1 = server_client.read_string_exactly(4);
+        auto s2 = server_client.read_string_exactly(6);
+        return s1 + s2;
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    client.write("test");
+    client.write("123456");
+
+    ASSERT_EQ("test123456", server_future.get());
+
+    client.close();
+    server.close();
+}
+
+TEST(server_socket, streaming_read_past_eof) {
+    fiberio::use_on_this_thread();
+
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.write("abc");
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    client.set_streaming(true);
+
+    server_future.get();
+    server.close();
+
+    ASSERT_EQ("ab", client.read_string_exactly(2));
+    ASSERT_EQ("c", client.read_string(10));
+    ASSERT_TRUE(client.is_open());
+    ASSERT_EQ("", client.read_string(1));
+    ASSERT_FALSE(client.is_open());
+    ASSERT_THROW(client.read_string(1), fiberio::socket_closed_error);
+}
+
+TEST(server_socket, streaming_large_write_small_buffer) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.set_streaming(true, 1000);
+        std::string data;
+        while (server_client.is_open()) {
+            data += server_client.read_string(333);
+        }
+        return data;
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    std::string data_to_write(1024*1024, 't');
+    client.write(data_to_write);
+    client.close();
+
+    ASSERT_EQ(data_to_write, server_future.get());
+
+    server.close();
+}
+
+TEST(server_socket, streaming_disabled_keeps_buffered_data) {
+    fiberio::use_on_this_thread();
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        server_client.set_streaming(true);
+        auto s1 = server_client.read_string_exactly(1);
+        this_fiber::sleep_for(std::chrono::milliseconds{10});
+        server_client.set_streaming(false);
+        auto s2 = server_client.read_string_exactly(9);
+        return s1 + s2;
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+    client.write("01234");
+    client.write("56789");
+
+    ASSERT_EQ("0123456789", server_future.get());
+
+    client.close();
+    server.close();
+}
+
 TEST(server_socket, iostream_read_write) {
     fiberio::use_on_this_thread();
     fiberio::server_socket server;
@@ -429,3 +1744,48 @@ TEST(server_socket, connect_stream) {
 
     server.close();
 }
+
+TEST(server_socket, work_stealing_socket_from_other_thread) {
+    fiberio::use_work_stealing_on_this_thread(2);
+    fiberio::server_socket server;
+    server.bind("127.0.0.1", 0);
+    server.listen(50);
+
+    auto server_future = fibers::async([&server]() {
+        auto server_client = server.accept();
+        std::string data = server_client.read_string_exactly(3);
+        server_client.write(data);
+        server_client.close();
+    });
+
+    fiberio::socket client;
+    client.connect(server.get_host(), server.get_port());
+
+    // A fiber started on the other thread is moved here to use the socket
+    fibers::promise<std::string> result;
+    auto thread = std::async(std::launch::async, [&client, &result]() {
+        fiberio::use_work_stealing_on_this_thread(2);
+        fibers::async([&client, &result]() {
+            client.write("abc");
+            result.set_value(client.read_string_exactly(3));
+        }).get();
+    });
+
+    ASSERT_EQ("abc", result.get_future().get());
+    thread.get();
+    server_future.get();
+
+    client.close();
+    server.close();
+    fiberio::use_on_this_thread();
+}
+
+TEST(server_socket, socket_from_other_thread) {
+    fiberio::use_on_this_thread();
+    fiberio::socket client;
+    auto thread = std::async(std::launch::async, [&client]() {
+        fiberio::use_on_this_thread();
+        ASSERT_THROW(client.write("abc"), fiberio::io_error);
+    });
+    thread.get();
+}